@@ -0,0 +1,312 @@
+// Benchmark suite: kernels, round counts, output sizes, odd chunked updates,
+// short reads, multi-stream records, fast-key-erasure and thread counts.
+// Progress on stderr, results as JSON on stdout.
+//
+// Usage: randquik-bench [-t seconds per measurement] [-m max size] [-k kernel]
+
+#define _GNU_SOURCE
+#include "charandom.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+static double budget = 0.2;       // Seconds spent on each measurement
+static uint64_t max_size = 1 << 30; // Largest single output
+static const char* only_kernel = NULL;
+static bool first_result = true;
+
+#define MAX_SAMPLES 100000
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/// Time stamp counter where there is one, which counts at the nominal clock
+static uint64_t cycles(void) {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int cmp_double(const void* a, const void* b) {
+    const double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/// One benchmark case, run() produces bytes of output in reps calls
+typedef struct bench {
+    const char* test;
+    const char* kernel;
+    unsigned rounds, threads, reps;
+    uint64_t size;
+    void (*run)(struct bench*);
+    cha_ctx ctx;
+    cha_pool* pool;
+    uint8_t* buf;
+    uint64_t bytes;
+} bench;
+
+static void measure(bench* b) {
+    static double samples[MAX_SAMPLES];
+    unsigned n = 0;
+    b->run(b); // Warm up caches, page faults and clocks
+    const double start = now();
+    const uint64_t c0 = cycles();
+    double t = start;
+    do {
+        b->run(b);
+        const double t2 = now();
+        samples[n++] = t2 - t;
+        t = t2;
+    } while ((t - start < budget || n < 3) && n < MAX_SAMPLES);
+    const uint64_t c = cycles() - c0;
+    const double total = t - start, bytes = (double)b->bytes * n;
+    const double percall = 1e9 / b->reps; // Latencies in ns per call
+    qsort(samples, n, sizeof *samples, cmp_double);
+
+    fprintf(
+      stderr, "%-9s %-7s r%-2u %2u thr %11" PRIu64 " B  %7.2f GB/s %9.1f ns\n",
+      b->test, b->kernel, b->rounds, b->threads, b->size,
+      bytes / total * 1e-9, total / n * percall
+    );
+    printf(
+      "%s\n    {\"test\": \"%s\", \"kernel\": \"%s\", \"rounds\": %u, "
+      "\"threads\": %u, \"size\": %" PRIu64 ", \"calls\": %" PRIu64 ", "
+      "\"gbps\": %.4f, \"ns_per_call\": %.2f, ",
+      first_result ? "" : ",", b->test, b->kernel, b->rounds, b->threads,
+      b->size, (uint64_t)n * b->reps, bytes / total * 1e-9, total / n * percall
+    );
+    if (c)
+        printf("\"cycles_per_byte\": %.4f, ", c / bytes);
+    else
+        printf("\"cycles_per_byte\": null, ");
+    printf(
+      "\"latency_ns\": {\"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, "
+      "\"max\": %.0f}}",
+      percall * samples[n / 2], percall * samples[n * 9 / 10],
+      percall * samples[n * 99 / 100], percall * samples[n - 1]
+    );
+    first_result = false;
+    fflush(stdout);
+}
+
+static void run_update(bench* b) { cha_update(&b->ctx, b->buf, b->size); }
+
+static void run_xor(bench* b) {
+    cha_xor_update(&b->ctx, b->buf, b->buf, b->size);
+}
+
+// Odd sizes that keep leaving bytes in the unconsumed buffer
+static const uint64_t odd_chunks[] = {1, 7, 63, 100, 1000, 1025, 4097, 65537};
+
+static void run_chunked(bench* b) {
+    uint8_t* out = b->buf;
+    for (size_t i = 0; i < sizeof odd_chunks / sizeof *odd_chunks; ++i) {
+        cha_update(&b->ctx, out, odd_chunks[i]);
+        out += odd_chunks[i];
+    }
+}
+
+// Short reads, timed in batches of calls as one is below clock resolution
+#define SHORT_REPS 1000
+static const uint64_t short_sizes[] = {4, 8, 16, 32, 64, 128, 255};
+
+static void run_short(bench* b) {
+    for (unsigned i = 0; i < SHORT_REPS; ++i)
+        cha_update(&b->ctx, b->buf, b->size);
+}
+
+static volatile uint64_t sink;
+
+static void run_u64(bench* b) {
+    uint64_t x = 0;
+    for (unsigned i = 0; i < SHORT_REPS; ++i) x += cha_u64(&b->ctx);
+    sink = x;
+}
+
+static void run_u32(bench* b) {
+    uint64_t x = 0;
+    for (unsigned i = 0; i < SHORT_REPS; ++i) x += cha_u32(&b->ctx);
+    sink = x;
+}
+
+static void run_bounded(bench* b) {
+    uint64_t x = 0;
+    for (unsigned i = 0; i < SHORT_REPS; ++i) x += cha_bounded(&b->ctx, 1000);
+    sink = x;
+}
+
+// Records each of their own key, generated together in one call
+static uint8_t multi_keys[SHORT_REPS * 32], multi_ivs[SHORT_REPS * 16];
+static uint8_t* multi_outs[SHORT_REPS];
+static uint64_t multi_lens[SHORT_REPS];
+
+static void run_multi(bench* b) {
+    cha_generate_multi(
+      multi_outs, multi_lens, multi_keys, multi_ivs, SHORT_REPS, b->rounds
+    );
+}
+
+static cha_fke fke;
+
+static void run_fke(bench* b) {
+    for (unsigned i = 0; i < b->reps; ++i) cha_fke_update(&fke, b->buf, b->size);
+}
+
+static void run_parallel(bench* b) {
+    cha_update_parallel(b->pool, &b->ctx, b->buf, b->size);
+}
+
+static void setup(
+  bench* b, const char* test, const cha_kernel* k, unsigned rounds,
+  uint64_t size, uint8_t* buf, void (*run)(bench*)
+) {
+    static const uint8_t key[32], iv[16];
+    b->test = test;
+    b->kernel = k->name;
+    b->rounds = rounds;
+    b->threads = b->reps = 1;
+    b->size = b->bytes = size;
+    b->buf = buf;
+    b->run = run;
+    b->pool = NULL;
+    cha_init(&b->ctx, key, iv, rounds);
+    _cha_use_kernel(&b->ctx, k);
+}
+
+int main(int argc, char** argv) {
+    for (int opt; (opt = getopt(argc, argv, "t:m:k:")) != -1;) {
+        if (opt == 't')
+            budget = atof(optarg);
+        else if (opt == 'm')
+            max_size = strtoull(optarg, NULL, 0);
+        else if (opt == 'k')
+            only_kernel = optarg;
+        else {
+            fprintf(
+              stderr,
+              "Usage: %s [-t seconds per measurement] [-m max size] "
+              "[-k kernel]\n",
+              argv[0]
+            );
+            return 1;
+        }
+    }
+    if (max_size < 64)
+        max_size = 64;
+    uint8_t* buf = malloc(max_size);
+    if (!buf) {
+        fprintf(stderr, "Out of memory for %" PRIu64 " bytes\n", max_size);
+        return 1;
+    }
+    memset(buf, 0, max_size);
+
+    static const unsigned rounds[] = {8, 12, 20};
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    bench b;
+    cha_init(&b.ctx, (const uint8_t[32]){0}, (const uint8_t[16]){0}, 20);
+    printf(
+      "{\"cpus\": %ld, \"default_kernel\": \"%s\", \"results\": [", cpus,
+      cha_kernel_name(&b.ctx)
+    );
+    const cha_kernel* kdefault = _cha_kernel;
+
+    for (size_t i = 0; i < sizeof cha_kernels / sizeof *cha_kernels; ++i) {
+        const cha_kernel* k = &cha_kernels[i];
+        if (!_cha_kernel_supported(k) ||
+            (only_kernel && strcmp(only_kernel, k->name)))
+            continue;
+        for (size_t r = 0; r < sizeof rounds / sizeof *rounds; ++r) {
+            for (uint64_t size = 64; size <= max_size; size *= 16) {
+                setup(&b, "generate", k, rounds[r], size, buf, run_update);
+                measure(&b);
+            }
+            const uint64_t xsize = max_size < (4 << 20) ? max_size : 4 << 20;
+            setup(&b, "xor", k, rounds[r], xsize, buf, run_xor);
+            measure(&b);
+            uint64_t total = 0;
+            for (size_t j = 0; j < sizeof odd_chunks / sizeof *odd_chunks; ++j)
+                total += odd_chunks[j];
+            if (total <= max_size) {
+                setup(&b, "chunked", k, rounds[r], total, buf, run_chunked);
+                measure(&b);
+            }
+        }
+    }
+
+    // Short reads in ns per call, on the default kernel
+    for (size_t i = 0; kdefault && i < sizeof short_sizes / sizeof *short_sizes; ++i) {
+        setup(&b, "short", kdefault, 20, short_sizes[i], buf, run_short);
+        b.reps = SHORT_REPS;
+        b.bytes = SHORT_REPS * short_sizes[i];
+        measure(&b);
+    }
+    static const struct {
+        const char* test;
+        uint64_t size;
+        void (*run)(bench*);
+    } draws[] = {
+      {"u64", 8, run_u64}, {"u32", 4, run_u32}, {"bounded", 8, run_bounded}
+    };
+    for (size_t i = 0; kdefault && i < sizeof draws / sizeof *draws; ++i) {
+        setup(&b, draws[i].test, kdefault, 20, draws[i].size, buf, draws[i].run);
+        b.reps = SHORT_REPS;
+        b.bytes = SHORT_REPS * draws[i].size;
+        measure(&b);
+    }
+
+    // Per-record streams, in ns per record
+    static const uint64_t record_sizes[] = {64, 512};
+    for (size_t i = 0; kdefault && i < sizeof record_sizes / sizeof *record_sizes; ++i) {
+        if (SHORT_REPS * record_sizes[i] > max_size)
+            continue;
+        setup(&b, "multi", kdefault, 20, record_sizes[i], buf, run_multi);
+        for (unsigned j = 0; j < SHORT_REPS; ++j) {
+            multi_outs[j] = buf + j * record_sizes[i];
+            multi_lens[j] = record_sizes[i];
+        }
+        b.reps = SHORT_REPS;
+        b.bytes = SHORT_REPS * record_sizes[i];
+        measure(&b);
+    }
+
+    // Fast-key-erasure, short reads and bulk
+    static const uint64_t fke_sizes[] = {16, 1 << 20};
+    for (size_t i = 0; kdefault && i < sizeof fke_sizes / sizeof *fke_sizes; ++i) {
+        if (fke_sizes[i] > max_size)
+            continue;
+        setup(&b, "fke", kdefault, 20, fke_sizes[i], buf, run_fke);
+        cha_fke_init(&fke, (const uint8_t[32]){0}, 20);
+        b.reps = fke_sizes[i] < CHA_FKE_SIZE ? SHORT_REPS : 1;
+        b.bytes = b.reps * fke_sizes[i];
+        measure(&b);
+    }
+    cha_fke_wipe(&fke);
+
+    // Thread counts for sizing workers, on the default kernel
+    const uint64_t psize = max_size < (256 << 20) ? max_size : 256 << 20;
+    for (unsigned threads = 1; kdefault; threads *= 2) {
+        if (threads > cpus)
+            threads = cpus;
+        setup(&b, "parallel", kdefault, 20, psize, buf, run_parallel);
+        b.pool = cha_pool_create(threads);
+        if (!b.pool)
+            break;
+        b.threads = b.pool->nthreads;
+        measure(&b);
+        cha_pool_destroy(b.pool);
+        if (threads >= cpus)
+            break;
+    }
+    printf("\n]}\n");
+    cha_wipe(&b.ctx);
+    free(buf);
+    return 0;
+}
@@ -1,4 +1,4 @@
-#include "chacha20.h"
+#include "charandom.h"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -8,7 +8,7 @@ int main(void) {
     const uint8_t key[32] = {0};
     const uint8_t nonce[16] = {0};
     for (uint64_t i = 0; i < 1000; ++i) {
-        cha_generate(buf, N, key, nonce);
+        cha_generate(buf, N, key, nonce, 20);
     }
     for (unsigned i = 0; i < 16; ++i)
         printf("%02X ", buf[i]);
@@ -0,0 +1,68 @@
+"""Compile the API mode extension randquik._cha: python randquik/_cha_build.py
+
+Without it, randquik.cha falls back to loading the Meson built library.
+"""
+from pathlib import Path
+
+import cffi
+
+src = Path(__file__).parent.parent / "src"
+
+CDEF = """
+    typedef uint64_t (*genfunc)(
+        uint8_t* out, size_t outsize, uint32_t state[16], unsigned rounds
+    );
+    typedef uint64_t (*xorfunc)(
+        uint8_t* out, const uint8_t* in, size_t outsize, uint32_t state[16], unsigned rounds
+    );
+    typedef struct cha_ctx {
+        uint32_t state[16];
+        uint8_t unconsumed[1024];
+        uint32_t offset, end;
+        uint32_t batch;
+        unsigned rounds;
+        genfunc gen;
+        xorfunc xgen;
+    } cha_ctx;
+
+    void cha_generate(uint8_t* out, uint64_t outlen, const uint8_t key[32], const uint8_t iv[16], unsigned rounds);
+    void cha_generate_multi(uint8_t* const* outs, const uint64_t* lens, const uint8_t* keys, const uint8_t* ivs, size_t n, unsigned rounds);
+
+    void cha_init(cha_ctx* ctx, const uint8_t* key, const uint8_t* iv, unsigned rounds);
+    void cha_wipe(cha_ctx* ctx);
+    const char* cha_kernel_name(const cha_ctx* ctx);
+    void cha_update(cha_ctx* ctx, uint8_t* out, uint64_t outlen);
+    void cha_xor_update(cha_ctx* ctx, const uint8_t* in, uint8_t* out, uint64_t len);
+    void cha_update_many(cha_ctx* ctx, uint8_t* const* outs, const uint64_t* lens, size_t n);
+
+    void cha_fill_uniform_f64(cha_ctx* ctx, double* out, size_t n);
+    void cha_fill_uniform_f32(cha_ctx* ctx, float* out, size_t n);
+    void cha_fill_bounded_u32(cha_ctx* ctx, uint32_t* out, size_t n, uint32_t bound);
+    void cha_fill_normal_f64(cha_ctx* ctx, double* out, size_t n);
+
+    void randquik_bytes(void* buf, size_t n);
+    uint64_t randquik_u64(void);
+    uint32_t randquik_u32(void);
+
+    typedef struct cha_pool cha_pool;
+    cha_pool* cha_pool_create(unsigned nthreads);
+    void cha_pool_destroy(cha_pool* pool);
+    void cha_update_parallel(cha_pool* pool, cha_ctx* ctx, uint8_t* out, uint64_t outlen);
+    void cha_generate_parallel(uint8_t* out, uint64_t outlen, const uint8_t key[32], const uint8_t iv[16], unsigned rounds, unsigned nthreads);
+
+    typedef struct cha_map cha_map;
+    cha_map* cha_map_create(const uint8_t key[32], const uint8_t iv[16], unsigned rounds, uint64_t size, size_t cached);
+    void cha_map_destroy(cha_map* m);
+"""
+
+ffibuilder = cffi.FFI()
+ffibuilder.cdef(CDEF)
+ffibuilder.set_source(
+    "randquik._cha",
+    '#include "charandom.h"\n#include "chadist.h"\n#include "chaglobal.h"\n#include "chamap.h"',
+    include_dirs=[src.as_posix()],
+    extra_compile_args=["-O3"],
+)
+
+if __name__ == "__main__":
+    ffibuilder.compile(tmpdir=Path(__file__).parent.parent.as_posix(), verbose=True)
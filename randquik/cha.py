@@ -2,40 +2,22 @@ import sys
 from pathlib import Path
 from typing import Any
 
-import cffi
+try:
+    # API mode extension, if compiled by randquik/_cha_build.py
+    from randquik._cha import ffi, lib
+except ImportError:
+    import cffi
 
-src = Path(__file__).parent.parent / "src"
+    from randquik._cha_build import CDEF
 
-if not src.is_dir():
-    raise RuntimeError("Unable to find RandQuik C sources in {src}")
-
-ffi = cffi.FFI()
-ffi.cdef(
-    """
-    typedef uint64_t (*genfunc)(
-        uint8_t* out, size_t outsize, uint32_t state[16], unsigned rounds
-    );
-    typedef struct cha_ctx {
-        uint32_t input[16];
-        uint8_t unconsumed[512];
-        uint32_t offset, end;
-        unsigned rounds;
-        genfunc gen;
-    } cha_ctx;
-
-    int cha_generate(uint8_t* out, uint64_t outlen, const uint8_t key[32], const uint8_t iv[16], unsigned rounds);
-
-    void cha_init(cha_ctx* ctx, const uint8_t* key, const uint8_t* iv, unsigned rounds);
-    void cha_wipe(cha_ctx* ctx);
-    int cha_update(cha_ctx* ctx, uint8_t* out, uint64_t outlen);
-    """
-)
-libname = "librandquik-chacha20.so"
-if sys.platform == "darwin":
-    libname = "librandquik-chacha20.dylib"
-elif sys.platform == "win32":
-    libname = "randquik-chacha20.dll"
-lib = ffi.dlopen((Path(__file__).parent.parent / f"build/{libname}").as_posix())
+    libname = "librandquik-chacha20.so"
+    if sys.platform == "darwin":
+        libname = "librandquik-chacha20.dylib"
+    elif sys.platform == "win32":
+        libname = "randquik-chacha20.dll"
+    ffi = cffi.FFI()
+    ffi.cdef(CDEF)
+    lib = ffi.dlopen((Path(__file__).parent.parent / f"build/{libname}").as_posix())
 
 
 def _processKeys(key, iv):
@@ -58,21 +40,50 @@ def _processKeys(key, iv):
 
 def _processBuffer(out):
     try:
-        outlen = out.nbytes
-    except AttributeError:
-        out = memoryview(out)
-        outlen = out.nbytes
-    if getattr(out, "readonly", None):
-        raise ValueError("The output buffer must be writable, not e.g. `bytes`")
-    return ffi.from_buffer(out), outlen
+        outbuf = ffi.from_buffer("uint8_t[]", out, require_writable=True)
+    except TypeError:
+        raise ValueError(
+            "The output buffer must be writable, not e.g. `bytes`"
+        ) from None
+    return outbuf, len(outbuf)
+
+
+def _processTyped(out, ctype, fmt):
+    """Writable output of a C type, e.g. array("d") or a Numpy float64 array"""
+    try:
+        mv = memoryview(out)
+    except TypeError:
+        raise ValueError("The output must support the buffer interface") from None
+    ok = mv.format.lstrip("@=<") in fmt and mv.itemsize == ffi.sizeof(ctype)
+    if not ok or mv.readonly or not mv.c_contiguous:
+        raise ValueError(f"The output must be a writable contiguous {ctype} array")
+    outbuf = ffi.from_buffer(f"{ctype}[]", out, require_writable=True)
+    return outbuf, len(outbuf)
 
 
 class Cha:
-    def __init__(self, key: bytes | Any, iv: bytes | Any, *, rounds=20):
-        """Construct a generator that holds its internal state, moving forward on each call."""
+    def __init__(
+        self, key: bytes | Any, iv: bytes | Any, *, rounds=20, threads=1
+    ):
+        """Construct a generator that holds its internal state, moving forward on each call.
+
+        With threads other than 1 (0 = all CPUs), large requests are split
+        between a pool of threads kept by the generator. Output is the same.
+        """
         key, iv = _processKeys(key, iv)
         self.ctx = ffi.new("cha_ctx*")
+        self.pool = None
         lib.cha_init(self.ctx, key, iv, rounds)
+        if threads != 1:
+            pool = lib.cha_pool_create(threads)
+            if pool == ffi.NULL:
+                raise MemoryError("Unable to create thread pool")
+            self.pool = ffi.gc(pool, lib.cha_pool_destroy)
+
+    @property
+    def kernel(self) -> str:
+        """Name of the SIMD kernel in use, e.g. "avx2" """
+        return ffi.string(lib.cha_kernel_name(self.ctx)).decode()
 
     def __del__(self):
         lib.cha_wipe(self.ctx)
@@ -80,9 +91,101 @@ class Cha:
     def __call__(self, out: bytearray | Any):
         """Fill the parameter with random bytes"""
         outbuf, outlen = _processBuffer(out)
-        lib.cha_update(self.ctx, outbuf, outlen)
+        if self.pool is None:
+            lib.cha_update(self.ctx, outbuf, outlen)
+        else:
+            lib.cha_update_parallel(self.pool, self.ctx, outbuf, outlen)
+        return out
+
+    def xor(self, data: bytearray | Any, out: bytearray | Any = None):
+        """Encrypt or decrypt: XOR the keystream into data, in place unless out
+        (same length) is given. Takes one pass over memory, with no temporary."""
+        if out is None:
+            inbuf, inlen = outbuf, outlen = _processBuffer(data)
+            out = data
+        else:
+            inbuf = ffi.from_buffer(data)
+            inlen = len(inbuf)
+            outbuf, outlen = _processBuffer(out)
+        if inlen != outlen:
+            raise ValueError("out must be the same length as data")
+        lib.cha_xor_update(self.ctx, inbuf, outbuf, outlen)
+        return out
+
+    # Distributions converted in bulk by vectorised C code, into buffers such
+    # as array.array or Numpy arrays of the matching type
+
+    def uniform(self, out):
+        """Fill doubles (53 bits) or floats (24 bits) uniform in [0, 1)"""
+        if memoryview(out).itemsize == 4:
+            outbuf, n = _processTyped(out, "float", "f")
+            lib.cha_fill_uniform_f32(self.ctx, outbuf, n)
+        else:
+            outbuf, n = _processTyped(out, "double", "d")
+            lib.cha_fill_uniform_f64(self.ctx, outbuf, n)
+        return out
+
+    def bounded(self, out, bound: int):
+        """Fill uint32 values uniform in [0, bound), without modulo bias"""
+        if not 0 < bound < 1 << 32:
+            raise ValueError("bound must be in 1 to 2**32 - 1")
+        outbuf, n = _processTyped(out, "uint32_t", "IL")
+        lib.cha_fill_bounded_u32(self.ctx, outbuf, n, bound)
+        return out
+
+    def normal(self, out):
+        """Fill doubles with standard normal values"""
+        outbuf, n = _processTyped(out, "double", "d")
+        lib.cha_fill_normal_f64(self.ctx, outbuf, n)
         return out
 
+    def fill_many(self, buffers):
+        """Fill each of the buffers with the next random bytes, in one C call.
+
+        Same as calling the generator on each buffer in turn, without the
+        per-call overhead that dominates with small buffers.
+        """
+        bufs = [ffi.from_buffer("uint8_t[]", b, require_writable=True) for b in buffers]
+        outs = ffi.new("uint8_t*[]", bufs)
+        lens = ffi.new("uint64_t[]", [len(b) for b in bufs])
+        lib.cha_update_many(self.ctx, outs, lens, len(bufs))
+        return buffers
+
+
+class Map:
+    def __init__(
+        self, size: int, key: bytes | Any, iv: bytes | Any = bytes(16), *, rounds=20, cached=256
+    ):
+        """The keystream as a read-only memoryview `data` of size bytes, of which
+        only accessed parts are generated. Any offset reads the same bytes as
+        the stream at that position, the file never exists on disk.
+
+        At most cached chunks of 256 KiB are kept in memory. Linux only, using
+        userfaultfd. The data may only be used while the Map exists.
+        """
+        key, iv = _processKeys(key, iv)
+        m = lib.cha_map_create(key, iv, rounds, size, cached)
+        if m == ffi.NULL:
+            raise OSError(ffi.errno, "Unable to map the keystream (userfaultfd)")
+        self._map = ffi.gc(m, lib.cha_map_destroy)
+        # The data pointer is the first member of the opaque cha_map
+        data = ffi.cast("uint8_t**", m)[0]
+        self.data = memoryview(ffi.buffer(data, size)).toreadonly()
+
+    def __len__(self):
+        return len(self.data)
+
+
+def random_bytes(n: int) -> bytearray:
+    """Random bytes for keys and tokens, a fast replacement of os.urandom.
+
+    Served by a generator of each thread, seeded by the system, reseeded after
+    a fork and with fast-key-erasure, so that no state reveals past output.
+    """
+    out = bytearray(n)
+    lib.randquik_bytes(ffi.from_buffer(out), n)
+    return out
+
 
 def generate_into(
     out: bytearray | memoryview | Any,
@@ -90,15 +193,48 @@ def generate_into(
     iv: bytes | Any = bytes(16),
     *,
     rounds=20,
+    threads=1,
 ):
-    """Fill in random bytes into an existing array (buffer interface)"""
+    """Fill in random bytes into an existing array (buffer interface)
+
+    With threads other than 1 (0 = all CPUs) the work is split between
+    threads, giving the same output.
+    """
     key, iv = _processKeys(key, iv)
     outbuf, outlen = _processBuffer(out)
-    lib.cha_generate(outbuf, outlen, key, iv, rounds)
+    if threads == 1:
+        lib.cha_generate(outbuf, outlen, key, iv, rounds)
+    else:
+        lib.cha_generate_parallel(outbuf, outlen, key, iv, rounds, threads)
     return out
 
 
-def generate(outlen: int, key: bytes | Any, iv: bytes | Any = bytes(16), *, rounds=20):
+def generate_many(buffers, keys, ivs, *, rounds=20):
+    """Fill each buffer with the stream of its own key and iv, in one C call.
+
+    Same as generate_into on each, computed together with the SIMD lanes on
+    different streams, which is much faster for short records.
+    """
+    if not len(buffers) == len(keys) == len(ivs):
+        raise ValueError("buffers, keys and ivs must be of the same length")
+    pairs = [_processKeys(k, iv) for k, iv in zip(keys, ivs)]
+    keybuf = b"".join(ffi.buffer(k)[:] for k, _ in pairs)
+    ivbuf = b"".join(ffi.buffer(iv)[:] for _, iv in pairs)
+    bufs = [_processBuffer(b)[0] for b in buffers]
+    outs = ffi.new("uint8_t*[]", bufs)
+    lens = ffi.new("uint64_t[]", [len(b) for b in bufs])
+    lib.cha_generate_multi(outs, lens, keybuf, ivbuf, len(bufs), rounds)
+    return buffers
+
+
+def generate(
+    outlen: int,
+    key: bytes | Any,
+    iv: bytes | Any = bytes(16),
+    *,
+    rounds=20,
+    threads=1,
+):
     """Return a bytearray of random bytes"""
     assert outlen >= 0
-    return generate_into(bytearray(outlen), key, iv, rounds=rounds)
+    return generate_into(bytearray(outlen), key, iv, rounds=rounds, threads=threads)
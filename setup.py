@@ -1,11 +1,15 @@
 import os
-from distutils.core import setup
 
 import numpy
 from Cython.Build import cythonize
-from setuptools import Extension
+from setuptools import Extension, setup
 
-os.environ["CFLAGS"] = "-O3 -march=native -Wall -Wextra"
+# Kernels are compiled per instruction set and chosen at runtime, so the
+# extensions run on any CPU. RANDQUIK_NATIVE=1 tunes for the build machine
+# only, like meson's native option.
+os.environ["CFLAGS"] = "-O3 -Wall -Wextra"
+if os.environ.get("RANDQUIK_NATIVE") == "1":
+    os.environ["CFLAGS"] += " -march=native"
 extensions = [
     Extension(
         "nprand",
@@ -14,4 +18,7 @@ extensions = [
         define_macros=[("NPY_NO_DEPRECATED_API", "NPY_1_7_API_VERSION")],
     )
 ]
-setup(ext_modules=cythonize(extensions))
+setup(
+    ext_modules=cythonize(extensions),
+    cffi_modules=["randquik/_cha_build.py:ffibuilder"],
+)
@@ -0,0 +1,143 @@
+#include <immintrin.h> // AVX2
+
+// clang-format off
+
+/* Two independent sets of 8 blocks (x and y) interleaved line by line, so
+ * that the add/xor/rotate chain of one hides the latency of the other. This
+ * needs the 32 ymm registers of AVX-512VL: with the 16 of plain AVX2 part of
+ * the state spills to stack and it is slower than _cha_8block, so it is only
+ * built when the compiler flags enable AVX-512VL. */
+
+#define VEC8_ROT(A, IMM)                                                       \
+    _mm256_or_si256(_mm256_slli_epi32(A, IMM), _mm256_srli_epi32(A, (32 - IMM)))
+
+#define VEC8_LINE1(v, A, B, C, D)                                              \
+    v[A] = _mm256_add_epi32(v[A], v[B]);                                       \
+    v[D] = _mm256_shuffle_epi8(_mm256_xor_si256(v[D], v[A]), rot16)
+#define VEC8_LINE2(v, A, B, C, D)                                              \
+    v[C] = _mm256_add_epi32(v[C], v[D]);                                       \
+    v[B] = VEC8_ROT(_mm256_xor_si256(v[B], v[C]), 12)
+#define VEC8_LINE3(v, A, B, C, D)                                              \
+    v[A] = _mm256_add_epi32(v[A], v[B]);                                       \
+    v[D] = _mm256_shuffle_epi8(_mm256_xor_si256(v[D], v[A]), rot8)
+#define VEC8_LINE4(v, A, B, C, D)                                              \
+    v[C] = _mm256_add_epi32(v[C], v[D]);                                       \
+    v[B] = VEC8_ROT(_mm256_xor_si256(v[B], v[C]), 7)
+
+#define VEC8_LINES(LINE, v, A1, B1, C1, D1, A2, B2, C2, D2, A3, B3, C3, D3, A4, B4, C4, D4) \
+    LINE(v, A1, B1, C1, D1);                                                   \
+    LINE(v, A2, B2, C2, D2);                                                   \
+    LINE(v, A3, B3, C3, D3);                                                   \
+    LINE(v, A4, B4, C4, D4)
+
+#define VEC8_ROUND2(...)                                                       \
+    VEC8_LINES(VEC8_LINE1, x, __VA_ARGS__);                                   \
+    VEC8_LINES(VEC8_LINE1, y, __VA_ARGS__);                                   \
+    VEC8_LINES(VEC8_LINE2, x, __VA_ARGS__);                                   \
+    VEC8_LINES(VEC8_LINE2, y, __VA_ARGS__);                                   \
+    VEC8_LINES(VEC8_LINE3, x, __VA_ARGS__);                                   \
+    VEC8_LINES(VEC8_LINE3, y, __VA_ARGS__);                                   \
+    VEC8_LINES(VEC8_LINE4, x, __VA_ARGS__);                                   \
+    VEC8_LINES(VEC8_LINE4, y, __VA_ARGS__)
+
+#define TRANSPOSE(v, A, B, C, D)                                               \
+    {                                                                          \
+        const __m256i t0 = _mm256_unpacklo_epi32(v[A], v[B]),                  \
+                      t1 = _mm256_unpacklo_epi32(v[C], v[D]),                  \
+                      t2 = _mm256_unpackhi_epi32(v[A], v[B]),                  \
+                      t3 = _mm256_unpackhi_epi32(v[C], v[D]);                  \
+        v[A] = _mm256_unpacklo_epi64(t0, t1);                                  \
+        v[B] = _mm256_unpackhi_epi64(t0, t1);                                  \
+        v[C] = _mm256_unpacklo_epi64(t2, t3);                                  \
+        v[D] = _mm256_unpackhi_epi64(t2, t3);                                  \
+    }
+
+/* Store 32 bytes at offset K of the batch, XOR with input if there is one */
+#define STORE(K, V)                                                            \
+    {                                                                          \
+        __m256i w = V;                                                         \
+        if (in) w = _mm256_xor_si256(w, _mm256_loadu_si256((const __m256i*)(in + (K)))); \
+        _mm256_storeu_si256((__m256i*)(buf + (K)), w);                         \
+    }
+
+#define ONEOCTO(v, A, B, C, D, A2, B2, C2, D2, K)                              \
+    {                                                                          \
+        TRANSPOSE(v, A, B, C, D);                                              \
+        TRANSPOSE(v, A2, B2, C2, D2);                                          \
+        STORE(K, _mm256_permute2x128_si256(v[A], v[A2], 0x20));                \
+        STORE(K + 64, _mm256_permute2x128_si256(v[B], v[B2], 0x20));           \
+        STORE(K + 128, _mm256_permute2x128_si256(v[C], v[C2], 0x20));          \
+        STORE(K + 192, _mm256_permute2x128_si256(v[D], v[D2], 0x20));          \
+        STORE(K + 256, _mm256_permute2x128_si256(v[A], v[A2], 0x31));          \
+        STORE(K + 320, _mm256_permute2x128_si256(v[B], v[B2], 0x31));          \
+        STORE(K + 384, _mm256_permute2x128_si256(v[C], v[C2], 0x31));          \
+        STORE(K + 448, _mm256_permute2x128_si256(v[D], v[D2], 0x31));          \
+    }
+
+/* Counters in words 12 and 13 of v, add addv with carry */
+#define COUNTER_INCREMENT(v, addv)                                                                 \
+    {                                                                                              \
+        __m256i carry = v[12];                                                                     \
+        v[12] = _mm256_add_epi32(v[12], addv);                                                     \
+        carry = _mm256_srli_epi32(_mm256_and_si256(_mm256_xor_si256(v[12], carry), carry), 31);    \
+        v[13] = _mm256_add_epi32(v[13], carry);                                                    \
+    }
+
+CHA_INLINE uint64_t _cha_16block_avx2_impl(
+  uint8_t* buf, const uint8_t* in, size_t bufsize, uint32_t state[16], unsigned rounds
+) {
+    unsigned batches = bufsize / 1024;
+    /* constant for shuffling bytes (replacing multiple-of-8 rotates) */
+    const __m256i rot16 = _mm256_set_epi8(
+      13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+      13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2
+    );
+    const __m256i rot8 = _mm256_set_epi8(
+      14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+      14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3
+    );
+    const __m256i eight = _mm256_set1_epi32(8);
+    __m256i orig[16], origy[16];
+    for (int i = 0; i < 16; ++i)
+        orig[i] = _mm256_set1_epi32(state[i]);
+    COUNTER_INCREMENT(orig, _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+    for (int i = 0; i < 16; ++i) origy[i] = orig[i];
+    COUNTER_INCREMENT(origy, eight);
+
+    for (unsigned b = batches; b-->0;) {
+        __m256i x[16], y[16];
+        for (int i = 0; i < 16; ++i) x[i] = orig[i], y[i] = origy[i];
+        CHA_UNROLL
+        for (unsigned r = rounds / 2; r-->0;) {
+            VEC8_ROUND2(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+            VEC8_ROUND2(0, 5, 10, 15, 1, 6, 11, 12, 2, 7, 8, 13, 3, 4, 9, 14);
+        }
+        for (unsigned i = 0; i < 16; ++i) x[i] = _mm256_add_epi32(x[i], orig[i]);
+        ONEOCTO(x, 0, 1, 2, 3, 4, 5, 6, 7, 0);
+        ONEOCTO(x, 8, 9, 10, 11, 12, 13, 14, 15, 32);
+        for (unsigned i = 0; i < 16; ++i) y[i] = _mm256_add_epi32(y[i], origy[i]);
+        ONEOCTO(y, 0, 1, 2, 3, 4, 5, 6, 7, 512);
+        ONEOCTO(y, 8, 9, 10, 11, 12, 13, 14, 15, 544);
+        COUNTER_INCREMENT(orig, _mm256_set1_epi32(16));
+        COUNTER_INCREMENT(origy, _mm256_set1_epi32(16));
+        buf += 1024;
+        if (in) in += 1024;
+    }
+    state[12] = _mm256_extract_epi32(orig[12], 0);
+    state[13] = _mm256_extract_epi32(orig[13], 0);
+    return batches * 1024;
+}
+
+CHA_INSTANCES(_cha_16block_avx2)
+
+#undef COUNTER_INCREMENT
+#undef ONEOCTO
+#undef STORE
+#undef TRANSPOSE
+#undef VEC8_ROT
+#undef VEC8_LINE1
+#undef VEC8_LINE2
+#undef VEC8_LINE3
+#undef VEC8_LINE4
+#undef VEC8_LINES
+#undef VEC8_ROUND2
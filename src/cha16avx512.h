@@ -0,0 +1,156 @@
+#include <immintrin.h> // AVX-512F
+
+// clang-format off
+
+/* AVX-512 has native rotates (vprold), no shuffle tricks needed */
+#define VEC16_LINE1(A, B, C, D)                                                \
+    x[A] = _mm512_add_epi32(x[A], x[B]);                                       \
+    x[D] = _mm512_rol_epi32(_mm512_xor_si512(x[D], x[A]), 16)
+#define VEC16_LINE2(A, B, C, D)                                                \
+    x[C] = _mm512_add_epi32(x[C], x[D]);                                       \
+    x[B] = _mm512_rol_epi32(_mm512_xor_si512(x[B], x[C]), 12)
+#define VEC16_LINE3(A, B, C, D)                                                \
+    x[A] = _mm512_add_epi32(x[A], x[B]);                                       \
+    x[D] = _mm512_rol_epi32(_mm512_xor_si512(x[D], x[A]), 8)
+#define VEC16_LINE4(A, B, C, D)                                                \
+    x[C] = _mm512_add_epi32(x[C], x[D]);                                       \
+    x[B] = _mm512_rol_epi32(_mm512_xor_si512(x[B], x[C]), 7)
+
+#define VEC16_ROUND(                                                           \
+  A1, B1, C1, D1, A2, B2, C2, D2, A3, B3, C3, D3, A4, B4, C4, D4               \
+)                                                                              \
+    VEC16_LINE1(A1, B1, C1, D1);                                               \
+    VEC16_LINE1(A2, B2, C2, D2);                                               \
+    VEC16_LINE1(A3, B3, C3, D3);                                               \
+    VEC16_LINE1(A4, B4, C4, D4);                                               \
+    VEC16_LINE2(A1, B1, C1, D1);                                               \
+    VEC16_LINE2(A2, B2, C2, D2);                                               \
+    VEC16_LINE2(A3, B3, C3, D3);                                               \
+    VEC16_LINE2(A4, B4, C4, D4);                                               \
+    VEC16_LINE3(A1, B1, C1, D1);                                               \
+    VEC16_LINE3(A2, B2, C2, D2);                                               \
+    VEC16_LINE3(A3, B3, C3, D3);                                               \
+    VEC16_LINE3(A4, B4, C4, D4);                                               \
+    VEC16_LINE4(A1, B1, C1, D1);                                               \
+    VEC16_LINE4(A2, B2, C2, D2);                                               \
+    VEC16_LINE4(A3, B3, C3, D3);                                               \
+    VEC16_LINE4(A4, B4, C4, D4)
+
+/* 4x4 transpose within each 128-bit lane: x[A] lane k = words A..D of block 4k */
+#define TRANSPOSE(A, B, C, D)                                                  \
+    {                                                                          \
+        const __m512i t0 = _mm512_unpacklo_epi32(x[A], x[B]),                  \
+                      t1 = _mm512_unpacklo_epi32(x[C], x[D]),                  \
+                      t2 = _mm512_unpackhi_epi32(x[A], x[B]),                  \
+                      t3 = _mm512_unpackhi_epi32(x[C], x[D]);                  \
+        x[A] = _mm512_unpacklo_epi64(t0, t1);                                  \
+        x[B] = _mm512_unpackhi_epi64(t0, t1);                                  \
+        x[C] = _mm512_unpacklo_epi64(t2, t3);                                  \
+        x[D] = _mm512_unpackhi_epi64(t2, t3);                                  \
+    }
+
+/* Store 64 bytes at offset K of the batch, XOR with input if there is one */
+#define STORE(K, V)                                                            \
+    {                                                                          \
+        __m512i v = V;                                                         \
+        if (in) v = _mm512_xor_si512(v, _mm512_loadu_si512((const void*)(in + (K)))); \
+        _mm512_storeu_si512((void*)(buf + (K)), v);                            \
+    }
+
+/* 4x4 transpose of 128-bit lanes, writing blocks M, M+4, M+8 and M+12 */
+#define FOURBLOCKS(M)                                                          \
+    {                                                                          \
+        const __m512i t0 = _mm512_shuffle_i32x4(x[M], x[M + 4], 0x44),         \
+                      t1 = _mm512_shuffle_i32x4(x[M], x[M + 4], 0xEE),         \
+                      t2 = _mm512_shuffle_i32x4(x[M + 8], x[M + 12], 0x44),    \
+                      t3 = _mm512_shuffle_i32x4(x[M + 8], x[M + 12], 0xEE);    \
+        STORE(64 * (M), _mm512_shuffle_i32x4(t0, t2, 0x88));                   \
+        STORE(64 * (M + 4), _mm512_shuffle_i32x4(t0, t2, 0xDD));               \
+        STORE(64 * (M + 8), _mm512_shuffle_i32x4(t1, t3, 0x88));               \
+        STORE(64 * (M + 12), _mm512_shuffle_i32x4(t1, t3, 0xDD));              \
+    }
+
+#define COUNTER_INCREMENT(addv)                                                \
+    {                                                                          \
+        orig[12] = _mm512_add_epi32(orig[12], addv);                           \
+        const __mmask16 carry = _mm512_cmplt_epu32_mask(orig[12], addv);       \
+        orig[13] = _mm512_mask_add_epi32(orig[13], carry, orig[13], _mm512_set1_epi32(1)); \
+    }
+
+CHA_INLINE uint64_t _cha_16block_impl(
+  uint8_t* buf, const uint8_t* in, size_t bufsize, uint32_t state[16], unsigned rounds
+) {
+    unsigned batches = bufsize / 1024;
+    __m512i orig[16];
+    for (int i = 0; i < 16; ++i)
+        orig[i] = _mm512_set1_epi32(state[i]);
+    COUNTER_INCREMENT(_mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+
+    for (unsigned b = batches; b-->0;) {
+        __m512i x[16];
+        for (int i = 0; i < 16; ++i) x[i] = orig[i];
+        CHA_UNROLL
+        for (unsigned r = rounds / 2; r-->0;) {
+            VEC16_ROUND(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+            VEC16_ROUND(0, 5, 10, 15, 1, 6, 11, 12, 2, 7, 8, 13, 3, 4, 9, 14);
+        }
+        for (unsigned i = 0; i < 16; ++i) x[i] = _mm512_add_epi32(x[i], orig[i]);
+        TRANSPOSE(0, 1, 2, 3);
+        TRANSPOSE(4, 5, 6, 7);
+        TRANSPOSE(8, 9, 10, 11);
+        TRANSPOSE(12, 13, 14, 15);
+        FOURBLOCKS(0);
+        FOURBLOCKS(1);
+        FOURBLOCKS(2);
+        FOURBLOCKS(3);
+        COUNTER_INCREMENT(_mm512_set1_epi32(16));
+        buf += 1024;
+        if (in) in += 1024;
+    }
+    state[12] = _mm_cvtsi128_si32(_mm512_castsi512_si128(orig[12]));
+    state[13] = _mm_cvtsi128_si32(_mm512_castsi512_si128(orig[13]));
+    return batches * 1024;
+}
+
+CHA_INSTANCES(_cha_16block)
+
+/* Sixteen streams at once for cha_generate_multi, as in cha8avx2.h */
+#undef STORE
+#define STORE(K, V) _mm512_storeu_si512((void*)dst[(K) / 64], V)
+
+CHA_INLINE void _cha_16block_multi_impl(
+  uint8_t* const* dst, uint32_t* lanes, unsigned rounds
+) {
+    __m512i orig[16], x[16];
+    for (int i = 0; i < 16; ++i)
+        x[i] = orig[i] = _mm512_loadu_si512((const void*)(lanes + 16 * i));
+    CHA_UNROLL
+    for (unsigned r = rounds / 2; r-->0;) {
+        VEC16_ROUND(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+        VEC16_ROUND(0, 5, 10, 15, 1, 6, 11, 12, 2, 7, 8, 13, 3, 4, 9, 14);
+    }
+    for (unsigned i = 0; i < 16; ++i) x[i] = _mm512_add_epi32(x[i], orig[i]);
+    TRANSPOSE(0, 1, 2, 3);
+    TRANSPOSE(4, 5, 6, 7);
+    TRANSPOSE(8, 9, 10, 11);
+    TRANSPOSE(12, 13, 14, 15);
+    FOURBLOCKS(0);
+    FOURBLOCKS(1);
+    FOURBLOCKS(2);
+    FOURBLOCKS(3);
+    COUNTER_INCREMENT(_mm512_set1_epi32(1));
+    _mm512_storeu_si512((void*)(lanes + 16 * 12), orig[12]);
+    _mm512_storeu_si512((void*)(lanes + 16 * 13), orig[13]);
+}
+
+CHA_MULTI_INSTANCES(_cha_16block_multi)
+
+#undef COUNTER_INCREMENT
+#undef FOURBLOCKS
+#undef STORE
+#undef TRANSPOSE
+#undef VEC16_LINE1
+#undef VEC16_LINE2
+#undef VEC16_LINE3
+#undef VEC16_LINE4
+#undef VEC16_ROUND
@@ -7,23 +7,32 @@
     QUARTERSTEP(a, b, d, 16); QUARTERSTEP(c, d, b, 12); \
     QUARTERSTEP(a, b, d, 8);  QUARTERSTEP(c, d, b, 7); }
 
-static inline uint64_t _cha_block(uint8_t* buf, size_t bufsize, uint32_t state[16], unsigned rounds) {
+CHA_INLINE uint64_t _cha_block_impl(uint8_t* buf, const uint8_t* in, size_t bufsize, uint32_t state[16], unsigned rounds) {
     unsigned blocks = bufsize / 64;
-    uint32_t* out = (uint32_t*)buf;
     uint32_t x[16];
     for (unsigned b = blocks; b-->0;) {
         for (unsigned i = 0; i < 16; ++i) x[i] = state[i];  // Faster than memcpy
+        CHA_UNROLL
         for (unsigned i = rounds / 2; i-->0;) {
             // Mix columns, then diagonals
             for (unsigned j = 0; j < 4; ++j) QUARTERROUND(x[j], x[4 + j], x[8 + j], x[12 + j]);
             for (unsigned j = 0; j < 4; ++j) QUARTERROUND(x[j], x[4 + (j+1)%4], x[8 + (j+2)%4], x[12 + (j+3)%4]);
         }
-        for (unsigned i = 0; i < 16; ++i) *out++ = x[i] + state[i];
-        ++*(uint64_t*)(state + 12); // Increment counter
+        for (unsigned i = 0; i < 16; ++i) {
+            uint32_t v = x[i] + state[i], w;
+            if (in) { memcpy(&w, in + 4 * i, 4); v ^= w; }
+            memcpy(buf + 4 * i, &v, 4);
+        }
+        // Increment counter (without type punning, which breaks at -O2)
+        if (++state[12] == 0) ++state[13];
+        buf += 64;
+        if (in) in += 64;
     }
     memset(x, 0, sizeof x);
     return blocks * CHA_BLOCK_SIZE;
 }
 
+CHA_INSTANCES(_cha_block)
+
 #undef QUARTERROUND
 #undef QUARTERSTEP
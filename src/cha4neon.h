@@ -20,7 +20,14 @@
     x[C] = vaddq_u32(x[C], x[D]);                                          \
     x[B] = VEC4_ROT(veorq_u32(x[B], x[C]), 7)
 
-#define ONEQUAD(A, B, C, D, OUT)                                                \
+/* Store 16 bytes at offset K of the batch, XOR with input if there is one */
+#define STORE(K, V)                                                            \
+    {                                                                          \
+        if (in) V = veorq_u32(V, vld1q_u32((const uint32_t*)(in + (K))));   \
+        vst1q_u32((uint32_t*)(buf + (K)), V);                                     \
+    }
+
+#define ONEQUAD(A, B, C, D, K)                                                \
     {                                                                          \
         /* Add original block */                                               \
         x[A] = vaddq_u32(x[A], orig[A]);                                   \
@@ -35,10 +42,10 @@
         x[C] = vcombine_u32(vget_high_u32(ab.val[0]), vget_high_u32(cd.val[0])); \
         x[D] = vcombine_u32(vget_high_u32(ab.val[1]), vget_high_u32(cd.val[1])); \
         /* Write out 1/4 of each block */                                      \
-        vst1q_u32((uint32_t*)(OUT), x[A]);                               \
-        vst1q_u32((uint32_t*)(OUT + 64), x[B]);                          \
-        vst1q_u32((uint32_t*)(OUT + 128), x[C]);                         \
-        vst1q_u32((uint32_t*)(OUT + 192), x[D]);                         \
+        STORE(K, x[A]);                                                        \
+        STORE(K + 64, x[B]);                                                   \
+        STORE(K + 128, x[C]);                                                  \
+        STORE(K + 192, x[D]);                                                  \
     }
 
 #define COUNTER_INCREMENT(addv)                                          \
@@ -47,8 +54,9 @@
         orig[13] = vaddq_u32(orig[13], vshrq_n_u32(vcltq_u32(orig[12], addv), 31)); \
     }
 
-static inline uint64_t
-_cha_4block(uint8_t* buf, size_t bufsize, uint32_t state[16], unsigned rounds) {
+CHA_INLINE uint64_t _cha_4block_impl(
+  uint8_t* buf, const uint8_t* in, size_t bufsize, uint32_t state[16], unsigned rounds
+) {
     /* constant for shuffling bytes (replacing multiple-of-8 rotates) */
     const uint8x16_t rot16 = {
       2, 3, 0, 1,
@@ -72,6 +80,7 @@ _cha_4block(uint8_t* buf, size_t bufsize, uint32_t state[16], unsigned rounds) {
     for (unsigned b = batches; b-->0;) {
         uint32x4_t x[16];
         for (unsigned i = 0; i < 16; ++i) x[i] = orig[i];
+        CHA_UNROLL
         for (unsigned r = rounds / 2; r-->0;) {
             // Mix columns
             VEC4_QUARTERROUND(0, 4, 8, 12);
@@ -85,12 +94,13 @@ _cha_4block(uint8_t* buf, size_t bufsize, uint32_t state[16], unsigned rounds) {
             VEC4_QUARTERROUND(3, 4, 9, 14);
         }
         // Add original block, unpack output
-        ONEQUAD(0, 1, 2, 3, buf);
-        ONEQUAD(4, 5, 6, 7, buf + 16);
-        ONEQUAD(8, 9, 10, 11, buf + 32);
-        ONEQUAD(12, 13, 14, 15, buf + 48);
+        ONEQUAD(0, 1, 2, 3, 0);
+        ONEQUAD(4, 5, 6, 7, 16);
+        ONEQUAD(8, 9, 10, 11, 32);
+        ONEQUAD(12, 13, 14, 15, 48);
         COUNTER_INCREMENT(addv);
         buf += 256;
+        if (in) in += 256;
     }
     // Store counter
     state[12] = vgetq_lane_u32(orig[12], 0);
@@ -98,8 +108,11 @@ _cha_4block(uint8_t* buf, size_t bufsize, uint32_t state[16], unsigned rounds) {
     return batches * 256;
 }
 
+CHA_INSTANCES(_cha_4block)
+
 #undef COUNTER_INCREMENT
 #undef ONEQUAD
+#undef STORE
 #undef ONEQUAD_TRANSPOSE
 #undef VEC4_ROT
 #undef VEC4_QUARTERROUND
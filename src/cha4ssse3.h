@@ -1,9 +1,5 @@
-#if defined(__x86_64__)
 #include <emmintrin.h> // SSE2
 #include <tmmintrin.h> // SSSE3
-#elif defined(__aarch64__)
-#include "sse2neon.h"
-#endif
 #include <stdio.h>
 // clang-format off
 
@@ -22,7 +18,14 @@
     x[C] = _mm_add_epi32(x[C], x[D]);                                          \
     x[B] = VEC4_ROT(_mm_xor_si128(x[B], x[C]), 7)
 
-#define ONEQUAD(A, B, C, D, OUT)                                                \
+/* Store 16 bytes at offset K of the batch, XOR with input if there is one */
+#define STORE(K, V)                                                            \
+    {                                                                          \
+        if (in) V = _mm_xor_si128(V, _mm_loadu_si128((const __m128i*)(in + (K))));   \
+        _mm_storeu_si128((__m128i*)(buf + (K)), V);                                     \
+    }
+
+#define ONEQUAD(A, B, C, D, K)                                                \
     {                                                                          \
         /* Add original block */                                               \
         x[A] = _mm_add_epi32(x[A], orig[A]);                                   \
@@ -39,10 +42,10 @@
         x[C] = _mm_unpacklo_epi64(abh, cdh); /* a2 b2 c2 d2 */                 \
         x[D] = _mm_unpackhi_epi64(abh, cdh); /* a3 b3 c3 d3 */                 \
         /* Write out 1/4 of each block */                                      \
-        _mm_storeu_si128((__m128i*)(OUT), x[A]);                               \
-        _mm_storeu_si128((__m128i*)(OUT + 64), x[B]);                          \
-        _mm_storeu_si128((__m128i*)(OUT + 128), x[C]);                         \
-        _mm_storeu_si128((__m128i*)(OUT + 192), x[D]);                         \
+        STORE(K, x[A]);                                                        \
+        STORE(K + 64, x[B]);                                                   \
+        STORE(K + 128, x[C]);                                                  \
+        STORE(K + 192, x[D]);                                                  \
     }
 
 #define COUNTER_INCREMENT(addv)                                                \
@@ -53,8 +56,9 @@
         orig[13] = _mm_add_epi32(orig[13], carry);                              \
     }
 
-static inline uint64_t
-_cha_4block(uint8_t* buf, size_t bufsize, uint32_t state[16], unsigned rounds) {
+CHA_INLINE uint64_t _cha_4block_impl(
+  uint8_t* buf, const uint8_t* in, size_t bufsize, uint32_t state[16], unsigned rounds
+) {
     /* constant for shuffling bytes (replacing multiple-of-8 rotates) */
     const __m128i rot16 =
       _mm_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
@@ -70,6 +74,7 @@ _cha_4block(uint8_t* buf, size_t bufsize, uint32_t state[16], unsigned rounds) {
     for (unsigned b = batches; b-->0;) {
         __m128i x[16];
         for (unsigned i = 0; i < 16; ++i) x[i] = orig[i];
+        CHA_UNROLL
         for (unsigned r = rounds / 2; r-->0;) {
             // Mix columns
             VEC4_QUARTERROUND(0, 4, 8, 12);
@@ -83,12 +88,13 @@ _cha_4block(uint8_t* buf, size_t bufsize, uint32_t state[16], unsigned rounds) {
             VEC4_QUARTERROUND(3, 4, 9, 14);
         }
         // Add original block, unpack output
-        ONEQUAD(0, 1, 2, 3, buf);
-        ONEQUAD(4, 5, 6, 7, buf + 16);
-        ONEQUAD(8, 9, 10, 11, buf + 32);
-        ONEQUAD(12, 13, 14, 15, buf + 48);
+        ONEQUAD(0, 1, 2, 3, 0);
+        ONEQUAD(4, 5, 6, 7, 16);
+        ONEQUAD(8, 9, 10, 11, 32);
+        ONEQUAD(12, 13, 14, 15, 48);
         COUNTER_INCREMENT(addv);
         buf += 256;
+        if (in) in += 256;
     }
     // Store counter
     state[12] = _mm_cvtsi128_si32(orig[12]);
@@ -96,8 +102,11 @@ _cha_4block(uint8_t* buf, size_t bufsize, uint32_t state[16], unsigned rounds) {
     return batches * 256;
 }
 
+CHA_INSTANCES(_cha_4block)
+
 #undef COUNTER_INCREMENT
 #undef ONEQUAD
+#undef STORE
 #undef ONEQUAD_TRANSPOSE
 #undef VEC4_ROT
 #undef VEC4_QUARTERROUND
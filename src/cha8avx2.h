@@ -50,18 +50,26 @@
         x[D] = _mm256_unpackhi_epi64(t2, t3);                                  \
     }
 
-#define ONEOCTO(A, B, C, D, A2, B2, C2, D2, c)                                 \
+/* Store 32 bytes at offset K of the batch, XOR with input if there is one */
+#define STORE(K, V)                                                            \
+    {                                                                          \
+        __m256i v = V;                                                         \
+        if (in) v = _mm256_xor_si256(v, _mm256_loadu_si256((const __m256i*)(in + (K)))); \
+        _mm256_storeu_si256((__m256i*)(buf + (K)), v);                         \
+    }
+
+#define ONEOCTO(A, B, C, D, A2, B2, C2, D2, K)                                 \
     {                                                                          \
         TRANSPOSE(A, B, C, D);                                                 \
         TRANSPOSE(A2, B2, C2, D2);                                             \
-        _mm256_storeu_si256((__m256i*)(c), _mm256_permute2x128_si256(x[A], x[A2], 0x20));       \
-        _mm256_storeu_si256((__m256i*)(c + 64), _mm256_permute2x128_si256(x[B], x[B2], 0x20));  \
-        _mm256_storeu_si256((__m256i*)(c + 128), _mm256_permute2x128_si256(x[C], x[C2], 0x20)); \
-        _mm256_storeu_si256((__m256i*)(c + 192), _mm256_permute2x128_si256(x[D], x[D2], 0x20)); \
-        _mm256_storeu_si256((__m256i*)(c + 256), _mm256_permute2x128_si256(x[A], x[A2], 0x31)); \
-        _mm256_storeu_si256((__m256i*)(c + 320), _mm256_permute2x128_si256(x[B], x[B2], 0x31)); \
-        _mm256_storeu_si256((__m256i*)(c + 384), _mm256_permute2x128_si256(x[C], x[C2], 0x31)); \
-        _mm256_storeu_si256((__m256i*)(c + 448), _mm256_permute2x128_si256(x[D], x[D2], 0x31)); \
+        STORE(K, _mm256_permute2x128_si256(x[A], x[A2], 0x20));                \
+        STORE(K + 64, _mm256_permute2x128_si256(x[B], x[B2], 0x20));           \
+        STORE(K + 128, _mm256_permute2x128_si256(x[C], x[C2], 0x20));          \
+        STORE(K + 192, _mm256_permute2x128_si256(x[D], x[D2], 0x20));          \
+        STORE(K + 256, _mm256_permute2x128_si256(x[A], x[A2], 0x31));          \
+        STORE(K + 320, _mm256_permute2x128_si256(x[B], x[B2], 0x31));          \
+        STORE(K + 384, _mm256_permute2x128_si256(x[C], x[C2], 0x31));          \
+        STORE(K + 448, _mm256_permute2x128_si256(x[D], x[D2], 0x31));          \
     }
 
 #define COUNTER_INCREMENT(addv)                                                                    \
@@ -72,30 +80,22 @@
         orig[13] = _mm256_add_epi32(orig[13], carry);                                               \
     }
 
-static inline uint64_t
-_cha_8block(uint8_t* buf, size_t bufsize, uint32_t state[16], unsigned rounds) {
+/* constants for shuffling bytes (replacing multiple-of-8 rotates) */
+#define ROT_CONSTANTS                                                          \
+    const __m256i rot16 = _mm256_set_epi8(                                     \
+      13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,                    \
+      13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2                     \
+    );                                                                         \
+    const __m256i rot8 = _mm256_set_epi8(                                      \
+      14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,                    \
+      14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3                     \
+    )
+
+CHA_INLINE uint64_t _cha_8block_impl(
+  uint8_t* buf, const uint8_t* in, size_t bufsize, uint32_t state[16], unsigned rounds
+) {
     unsigned batches = bufsize / 512;
-    /* constant for shuffling bytes (replacing multiple-of-8 rotates) */
-    const __m256i rot16 = _mm256_set_epi8(
-      13, 12, 15, 14,
-      9, 8, 11, 10,
-      5, 4, 7, 6,
-      1, 0, 3, 2,
-      13, 12, 15, 14,
-      9, 8, 11, 10,
-      5, 4, 7, 6,
-      1, 0, 3, 2
-    );
-    const __m256i rot8 = _mm256_set_epi8(
-      14, 13, 12, 15,
-      10, 9, 8, 11,
-      6, 5, 4, 7,
-      2, 1, 0, 3,
-      14, 13, 12, 15,
-      10, 9, 8, 11,
-      6, 5, 4, 7,
-      2, 1, 0, 3
-    );
+    ROT_CONSTANTS;
     __m256i orig[16];
     for (int i = 0; i < 16; ++i)
         orig[i] = _mm256_set1_epi32(state[i]);
@@ -104,23 +104,57 @@ _cha_8block(uint8_t* buf, size_t bufsize, uint32_t state[16], unsigned rounds) {
     for (unsigned b = batches; b-->0;) {
         __m256i x[16];
         for (int i = 0; i < 16; ++i) x[i] = orig[i];
+        CHA_UNROLL
         for (unsigned r = rounds / 2; r-->0;) {
             VEC8_ROUND(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
             VEC8_ROUND(0, 5, 10, 15, 1, 6, 11, 12, 2, 7, 8, 13, 3, 4, 9, 14);
         }
         for (unsigned i = 0; i < 16; ++i) x[i] = _mm256_add_epi32(x[i], orig[i]);
-        ONEOCTO(0, 1, 2, 3, 4, 5, 6, 7, buf);
-        ONEOCTO(8, 9, 10, 11, 12, 13, 14, 15, buf + 32);
+        ONEOCTO(0, 1, 2, 3, 4, 5, 6, 7, 0);
+        ONEOCTO(8, 9, 10, 11, 12, 13, 14, 15, 32);
         COUNTER_INCREMENT(_mm256_set1_epi32(8));
         buf += 512;
+        if (in) in += 512;
     }
     state[12] = _mm256_extract_epi32(orig[12], 0);
     state[13] = _mm256_extract_epi32(orig[13], 0);
     return batches * 512;
 }
 
+CHA_INSTANCES(_cha_8block)
+
+/* Eight streams at once for cha_generate_multi: lane j computes the next
+ * block of the stream whose state is column j of lanes (16 words of 8 lanes)
+ * and writes it to dst[j]. Every lane's counter then advances by one. */
+#undef STORE
+#define STORE(K, V) _mm256_storeu_si256((__m256i*)(dst[(K) / 64] + (K) % 64), V)
+
+CHA_INLINE void _cha_8block_multi_impl(
+  uint8_t* const* dst, uint32_t* lanes, unsigned rounds
+) {
+    ROT_CONSTANTS;
+    __m256i orig[16], x[16];
+    for (int i = 0; i < 16; ++i)
+        x[i] = orig[i] = _mm256_loadu_si256((const __m256i*)(lanes + 8 * i));
+    CHA_UNROLL
+    for (unsigned r = rounds / 2; r-->0;) {
+        VEC8_ROUND(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+        VEC8_ROUND(0, 5, 10, 15, 1, 6, 11, 12, 2, 7, 8, 13, 3, 4, 9, 14);
+    }
+    for (unsigned i = 0; i < 16; ++i) x[i] = _mm256_add_epi32(x[i], orig[i]);
+    ONEOCTO(0, 1, 2, 3, 4, 5, 6, 7, 0);
+    ONEOCTO(8, 9, 10, 11, 12, 13, 14, 15, 32);
+    COUNTER_INCREMENT(_mm256_set1_epi32(1));
+    _mm256_storeu_si256((__m256i*)(lanes + 8 * 12), orig[12]);
+    _mm256_storeu_si256((__m256i*)(lanes + 8 * 13), orig[13]);
+}
+
+CHA_MULTI_INSTANCES(_cha_8block_multi)
+
 #undef COUNTER_INCREMENT
 #undef ONEOCTO
+#undef ROT_CONSTANTS
+#undef STORE
 #undef TRANSPOSE
 #undef VEC8_ROT
 #undef VEC8_LINE1
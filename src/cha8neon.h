@@ -0,0 +1,127 @@
+#include <arm_neon.h>
+#include <stdint.h>
+
+// clang-format off
+
+/* Two independent sets of 4 blocks (x and y) interleaved line by line, so
+ * that the add/xor/rotate chain of one hides the latency of the other. With
+ * 32 q registers both states stay in registers. */
+
+#define VEC4_ROT(A, IMM) vsriq_n_u32(vshlq_n_u32(A, IMM), A, 32 - IMM)
+
+#define VEC4_LINE1(v, A, B, C, D)                                              \
+    v[A] = vaddq_u32(v[A], v[B]);                                              \
+    v[D] = vreinterpretq_u32_u16(vrev32q_u16(vreinterpretq_u16_u32(veorq_u32(v[D], v[A]))))
+#define VEC4_LINE2(v, A, B, C, D)                                              \
+    v[C] = vaddq_u32(v[C], v[D]);                                              \
+    { const uint32x4_t t = veorq_u32(v[B], v[C]); v[B] = VEC4_ROT(t, 12); }
+#define VEC4_LINE3(v, A, B, C, D)                                              \
+    v[A] = vaddq_u32(v[A], v[B]);                                              \
+    v[D] = vreinterpretq_u32_u8(vqtbl1q_u8(vreinterpretq_u8_u32(veorq_u32(v[D], v[A])), rot8))
+#define VEC4_LINE4(v, A, B, C, D)                                              \
+    v[C] = vaddq_u32(v[C], v[D]);                                              \
+    { const uint32x4_t t = veorq_u32(v[B], v[C]); v[B] = VEC4_ROT(t, 7); }
+
+#define VEC4_LINES(LINE, v, A1, B1, C1, D1, A2, B2, C2, D2, A3, B3, C3, D3, A4, B4, C4, D4) \
+    LINE(v, A1, B1, C1, D1);                                                   \
+    LINE(v, A2, B2, C2, D2);                                                   \
+    LINE(v, A3, B3, C3, D3);                                                   \
+    LINE(v, A4, B4, C4, D4)
+
+#define VEC4_ROUND2(...)                                                       \
+    VEC4_LINES(VEC4_LINE1, x, __VA_ARGS__);                                   \
+    VEC4_LINES(VEC4_LINE1, y, __VA_ARGS__);                                   \
+    VEC4_LINES(VEC4_LINE2, x, __VA_ARGS__);                                   \
+    VEC4_LINES(VEC4_LINE2, y, __VA_ARGS__);                                   \
+    VEC4_LINES(VEC4_LINE3, x, __VA_ARGS__);                                   \
+    VEC4_LINES(VEC4_LINE3, y, __VA_ARGS__);                                   \
+    VEC4_LINES(VEC4_LINE4, x, __VA_ARGS__);                                   \
+    VEC4_LINES(VEC4_LINE4, y, __VA_ARGS__)
+
+/* Store 16 bytes at offset K of the batch, XOR with input if there is one */
+#define STORE(K, V)                                                            \
+    {                                                                          \
+        if (in) V = veorq_u32(V, vld1q_u32((const uint32_t*)(in + (K))));      \
+        vst1q_u32((uint32_t*)(buf + (K)), V);                                  \
+    }
+
+/* Transpose words A..D of four blocks and write them to each block */
+#define ONEQUAD(v, A, B, C, D, K)                                              \
+    {                                                                          \
+        const uint32x4x2_t ab = vtrnq_u32(v[A], v[B]);                         \
+        const uint32x4x2_t cd = vtrnq_u32(v[C], v[D]);                         \
+        v[A] = vcombine_u32(vget_low_u32(ab.val[0]), vget_low_u32(cd.val[0]));   \
+        v[B] = vcombine_u32(vget_low_u32(ab.val[1]), vget_low_u32(cd.val[1]));   \
+        v[C] = vcombine_u32(vget_high_u32(ab.val[0]), vget_high_u32(cd.val[0])); \
+        v[D] = vcombine_u32(vget_high_u32(ab.val[1]), vget_high_u32(cd.val[1])); \
+        STORE(K, v[A]);                                                        \
+        STORE(K + 64, v[B]);                                                   \
+        STORE(K + 128, v[C]);                                                  \
+        STORE(K + 192, v[D]);                                                  \
+    }
+
+#define COUNTER_INCREMENT(v, addv)                                             \
+    {                                                                          \
+        v[12] = vaddq_u32(v[12], addv);                                        \
+        v[13] = vaddq_u32(v[13], vshrq_n_u32(vcltq_u32(v[12], addv), 31));     \
+    }
+
+CHA_INLINE uint64_t _cha_8block_neon_impl(
+  uint8_t* buf, const uint8_t* in, size_t bufsize, uint32_t state[16], unsigned rounds
+) {
+    const uint8x16_t rot8 = {
+      3, 0, 1, 2,
+      7, 4, 5, 6,
+      11, 8, 9, 10,
+      15, 12, 13, 14
+    };
+    const uint32x4_t lanes = { 0, 1, 2, 3 };
+    uint32x4_t orig[16], origy[16];
+    for (unsigned i = 0; i < 16; ++i) orig[i] = vdupq_n_u32(state[i]);
+    COUNTER_INCREMENT(orig, lanes);
+    for (unsigned i = 0; i < 16; ++i) origy[i] = orig[i];
+    COUNTER_INCREMENT(origy, vdupq_n_u32(4));
+    const uint32x4_t addv = vdupq_n_u32(8);
+    const unsigned batches = bufsize / 512;
+    for (unsigned b = batches; b-->0;) {
+        uint32x4_t x[16], y[16];
+        for (unsigned i = 0; i < 16; ++i) x[i] = orig[i], y[i] = origy[i];
+        CHA_UNROLL
+        for (unsigned r = rounds / 2; r-->0;) {
+            VEC4_ROUND2(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+            VEC4_ROUND2(0, 5, 10, 15, 1, 6, 11, 12, 2, 7, 8, 13, 3, 4, 9, 14);
+        }
+        for (unsigned i = 0; i < 16; ++i) {
+            x[i] = vaddq_u32(x[i], orig[i]);
+            y[i] = vaddq_u32(y[i], origy[i]);
+        }
+        ONEQUAD(x, 0, 1, 2, 3, 0);
+        ONEQUAD(x, 4, 5, 6, 7, 16);
+        ONEQUAD(x, 8, 9, 10, 11, 32);
+        ONEQUAD(x, 12, 13, 14, 15, 48);
+        ONEQUAD(y, 0, 1, 2, 3, 256);
+        ONEQUAD(y, 4, 5, 6, 7, 272);
+        ONEQUAD(y, 8, 9, 10, 11, 288);
+        ONEQUAD(y, 12, 13, 14, 15, 304);
+        COUNTER_INCREMENT(orig, addv);
+        COUNTER_INCREMENT(origy, addv);
+        buf += 512;
+        if (in) in += 512;
+    }
+    state[12] = vgetq_lane_u32(orig[12], 0);
+    state[13] = vgetq_lane_u32(orig[13], 0);
+    return batches * 512;
+}
+
+CHA_INSTANCES(_cha_8block_neon)
+
+#undef COUNTER_INCREMENT
+#undef ONEQUAD
+#undef STORE
+#undef VEC4_ROT
+#undef VEC4_LINE1
+#undef VEC4_LINE2
+#undef VEC4_LINE3
+#undef VEC4_LINE4
+#undef VEC4_LINES
+#undef VEC4_ROUND2
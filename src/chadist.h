@@ -0,0 +1,209 @@
+#pragma once
+
+#include "charandom.h"
+
+#include <math.h>
+
+/* Distributions converted in batches from keystream made by the SIMD kernels.
+ * The conversions avoid integer to float instructions (which only AVX-512
+ * has for vectors), so that the compiler vectorises them at any -march.
+ *
+ * Each fill takes the stream from a source callback that is inlined, so the
+ * same code serves cha_ctx here and the Numpy generator in chanumpy.h. */
+
+typedef void (*cha_source)(void* src, void* out, size_t len);
+
+#define CHA_DIST_CHUNK 512 // Values converted at a time, from a stack buffer
+
+/// (x >> 11) * 2^-53 exactly, 53 random bits in [0, 1)
+static inline double _cha_unit_f64(uint64_t x) {
+    // Low 52 bits in the mantissa of 2^52, then the 53rd bit as 2^52 or 0
+    const uint64_t lo = (x >> 11 & 0xFFFFFFFFFFFFF) | 0x4330000000000000;
+    const uint64_t hi = -(x >> 63) & 0x4330000000000000;
+    double l, h;
+    memcpy(&l, &lo, sizeof l);
+    memcpy(&h, &hi, sizeof h);
+    return (l - 0x1p52 + h) * 0x1p-53;
+}
+
+/// (x >> 8) * 2^-24 exactly, 24 random bits in [0, 1)
+static inline float _cha_unit_f32(uint32_t x) {
+    const uint32_t lo = (x >> 8 & 0x7FFFFF) | 0x4B000000;
+    const uint32_t hi = -(x >> 31) & 0x4B000000;
+    float l, h;
+    memcpy(&l, &lo, sizeof l);
+    memcpy(&h, &hi, sizeof h);
+    return (l - 0x1p23f + h) * 0x1p-24f;
+}
+
+/// Uniform in (0, 1), never zero, for logarithms
+static inline double _cha_open_f64(uint64_t x) {
+    return ((double)(x >> 11) + 0.5) * 0x1p-53;
+}
+
+static inline void _cha_uniform_f64(
+  void* src, cha_source fill, double* out, size_t n
+) {
+    fill(src, out, n * sizeof(uint64_t));
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t x;
+        memcpy(&x, out + i, sizeof x);
+        out[i] = _cha_unit_f64(x);
+    }
+}
+
+static inline void _cha_uniform_f32(
+  void* src, cha_source fill, float* out, size_t n
+) {
+    fill(src, out, n * sizeof(uint32_t));
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t x;
+        memcpy(&x, out + i, sizeof x);
+        out[i] = _cha_unit_f32(x);
+    }
+}
+
+/// Lemire's multiply and shift. The threshold takes one division per call and
+/// the rare rejected values (low product under it) are redrawn after each
+/// chunk, keeping the main loop branch free.
+static inline void _cha_bounded_u32(
+  void* src, cha_source fill, uint32_t* out, size_t n, uint32_t bound
+) {
+    const uint32_t threshold = bound ? -bound % bound : 0;
+    uint32_t raw[CHA_DIST_CHUNK];
+    for (size_t start = 0; start < n; start += CHA_DIST_CHUNK) {
+        const size_t len = n - start < CHA_DIST_CHUNK ? n - start : CHA_DIST_CHUNK;
+        fill(src, raw, len * sizeof *raw);
+        uint32_t* o = out + start;
+        uint32_t rejects = 0;
+        for (size_t i = 0; i < len; ++i) {
+            const uint64_t m = (uint64_t)raw[i] * bound;
+            o[i] = m >> 32;
+            rejects |= (uint32_t)m < threshold;
+        }
+        for (size_t i = 0; rejects && i < len; ++i) {
+            uint64_t m = (uint64_t)raw[i] * bound;
+            while ((uint32_t)m < threshold) {
+                uint32_t x;
+                fill(src, &x, sizeof x);
+                m = (uint64_t)x * bound;
+            }
+            o[i] = m >> 32;
+        }
+    }
+    memset(raw, 0, sizeof raw);
+}
+
+/* Ziggurat of Marsaglia and Tsang with 128 layers, in double precision. Of a
+ * 64-bit draw the low 7 bits pick the layer and the top 52 bits are a signed
+ * value, so the two are independent. The value is compared as a double, as
+ * vectors have no 64-bit arithmetic shift or compare before AVX-512. */
+
+#define CHA_ZIG_R 3.442619855899 // Start of the tail
+static double _cha_zig_k[128], _cha_zig_w[128], _cha_zig_f[128];
+static pthread_once_t _cha_zig_once = PTHREAD_ONCE_INIT;
+
+static void _cha_zig_init(void) {
+    const double m = 0x1p51, v = 9.91256303526217e-3;
+    double dn = CHA_ZIG_R, tn = dn;
+    const double q = v / exp(-0.5 * dn * dn);
+    _cha_zig_k[0] = floor(dn / q * m);
+    _cha_zig_k[1] = 0;
+    _cha_zig_w[0] = q / m;
+    _cha_zig_w[127] = dn / m;
+    _cha_zig_f[0] = 1.0;
+    _cha_zig_f[127] = exp(-0.5 * dn * dn);
+    for (int i = 126; i >= 1; --i) {
+        dn = sqrt(-2.0 * log(v / dn + exp(-0.5 * dn * dn)));
+        _cha_zig_k[i + 1] = floor(dn / tn * m);
+        tn = dn;
+        _cha_zig_f[i] = exp(-0.5 * dn * dn);
+        _cha_zig_w[i] = dn / m;
+    }
+}
+
+/// Top 52 bits as an integer in [-2^51, 2^51), exact by the 2^52 magic number
+static inline double _cha_zig_value(uint64_t x) {
+    const uint64_t bits = x >> 12 | 0x4330000000000000;
+    double d;
+    memcpy(&d, &bits, sizeof d);
+    return d - 0x1.8p52;
+}
+
+/// Wedges and the tail: the slow path of a draw x that missed its rectangle
+static double _cha_zig_slow(void* src, cha_source fill, uint64_t x) {
+    for (;;) {
+        const unsigned i = x & 127;
+        const double h = _cha_zig_value(x), v = h * _cha_zig_w[i];
+        if (fabs(h) < _cha_zig_k[i])
+            return v;
+        uint64_t u[2];
+        if (i == 0) {
+            double t, y;
+            do {
+                fill(src, u, sizeof u);
+                t = -log(_cha_open_f64(u[0])) / CHA_ZIG_R;
+                y = -log(_cha_open_f64(u[1]));
+            } while (y + y < t * t);
+            return h > 0 ? CHA_ZIG_R + t : -CHA_ZIG_R - t;
+        }
+        fill(src, u, sizeof u);
+        const double f0 = _cha_zig_f[i], f1 = _cha_zig_f[i - 1];
+        if (f0 + _cha_unit_f64(u[0]) * (f1 - f0) < exp(-0.5 * v * v))
+            return v;
+        x = u[1];
+    }
+}
+
+static inline void _cha_normal_f64(
+  void* src, cha_source fill, double* out, size_t n
+) {
+    pthread_once(&_cha_zig_once, _cha_zig_init);
+    uint64_t raw[CHA_DIST_CHUNK];
+    for (size_t start = 0; start < n; start += CHA_DIST_CHUNK) {
+        const size_t len = n - start < CHA_DIST_CHUNK ? n - start : CHA_DIST_CHUNK;
+        fill(src, raw, len * sizeof *raw);
+        double* o = out + start;
+        uint64_t slow = 0; // Same width as the draws, else no vectorising
+        // Inside a rectangle, about 97 % of draws
+        for (size_t i = 0; i < len; ++i) {
+            const uint64_t l = raw[i] & 127;
+            const double h = _cha_zig_value(raw[i]);
+            o[i] = h * _cha_zig_w[l];
+            slow |= fabs(h) >= _cha_zig_k[l];
+        }
+        for (size_t i = 0; slow && i < len; ++i)
+            if (fabs(_cha_zig_value(raw[i])) >= _cha_zig_k[raw[i] & 127])
+                o[i] = _cha_zig_slow(src, fill, raw[i]);
+    }
+    memset(raw, 0, sizeof raw);
+}
+
+static void _cha_ctx_source(void* ctx, void* out, size_t len) {
+    cha_update((cha_ctx*)ctx, (uint8_t*)out, len);
+}
+
+/// @brief Doubles uniform in [0, 1) with 53 random bits, one 64-bit word each
+/// (the same as Numpy random on the bit generator)
+void cha_fill_uniform_f64(cha_ctx* ctx, double* out, size_t n) {
+    _cha_uniform_f64(ctx, _cha_ctx_source, out, n);
+}
+
+/// @brief Floats uniform in [0, 1) with 24 random bits, one 32-bit word each
+void cha_fill_uniform_f32(cha_ctx* ctx, float* out, size_t n) {
+    _cha_uniform_f32(ctx, _cha_ctx_source, out, n);
+}
+
+/// @brief Integers uniform in [0, bound) without modulo bias, 0 if bound is 0.
+/// One 32-bit word each, plus redraws for a fraction bound / 2^32 of them.
+void cha_fill_bounded_u32(
+  cha_ctx* ctx, uint32_t* out, size_t n, uint32_t bound
+) {
+    _cha_bounded_u32(ctx, _cha_ctx_source, out, n, bound);
+}
+
+/// @brief Standard normal doubles by Ziggurat, one 64-bit word each plus
+/// redraws for about 1 % of them
+void cha_fill_normal_f64(cha_ctx* ctx, double* out, size_t n) {
+    _cha_normal_f64(ctx, _cha_ctx_source, out, n);
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "charandom.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#if defined(__linux__)
+#include <sys/random.h>
+#endif
+
+/* Process wide random bytes without a lock: each thread lazily gets its own
+ * fast-key-erasure generator of ChaCha20, seeded by the system. A forked
+ * child reseeds before its first output, so that it never repeats the
+ * parent's stream. The pages are MADV_WIPEONFORK where supported, so that
+ * the child does not even hold the parent's keys, and a fork generation
+ * counter covers other systems. */
+
+typedef struct _cha_tls {
+    cha_fke fke;
+    uint64_t forks; // Fork generation that seeded it, 0 if wiped by a fork
+} _cha_tls;
+
+static __thread _cha_tls* _cha_tls_state;
+static pthread_key_t _cha_tls_key;
+static pthread_once_t _cha_tls_once = PTHREAD_ONCE_INIT;
+static uint64_t _cha_forks = 1; // Only changed in a child, which has one thread
+
+static void _cha_tls_fork(void) { ++_cha_forks; }
+
+/// Wipe and release the state of an exiting thread
+static void _cha_tls_free(void* p) {
+    memset(p, 0, sizeof(_cha_tls));
+    munmap(p, sizeof(_cha_tls));
+    _cha_tls_state = NULL;
+}
+
+static void _cha_tls_init(void) {
+    pthread_key_create(&_cha_tls_key, _cha_tls_free);
+    pthread_atfork(NULL, NULL, _cha_tls_fork);
+}
+
+/// 32 bytes from the system, or abort: running unseeded is never an option
+static void _cha_system_seed(uint8_t key[32]) {
+#if defined(__linux__)
+    if (getrandom(key, 32, 0) == 32)
+        return;
+#endif
+    const int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || read(fd, key, 32) != 32) {
+        fprintf(stderr, "randquik: unable to seed from /dev/urandom\n");
+        abort();
+    }
+    close(fd);
+}
+
+/// First use on this thread or first since a fork
+__attribute__((noinline)) static _cha_tls* _cha_tls_setup(_cha_tls* t) {
+    pthread_once(&_cha_tls_once, _cha_tls_init);
+    if (!t) {
+        t = mmap(
+          NULL, sizeof *t, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+          -1, 0
+        );
+        if (t == MAP_FAILED) {
+            fprintf(stderr, "randquik: out of memory for thread state\n");
+            abort();
+        }
+#ifdef MADV_WIPEONFORK
+        madvise(t, sizeof *t, MADV_WIPEONFORK);
+#endif
+        _cha_tls_state = t;
+        pthread_setspecific(_cha_tls_key, t);
+    }
+    uint8_t key[32];
+    _cha_system_seed(key);
+    cha_fke_init(&t->fke, key, 20);
+    memset(key, 0, sizeof key);
+    t->forks = _cha_forks;
+    return t;
+}
+
+static inline _cha_tls* _cha_tls_get(void) {
+    _cha_tls* t = _cha_tls_state;
+    if (t && t->forks == _cha_forks)
+        return t;
+    return _cha_tls_setup(t);
+}
+
+/// @brief Fill with random bytes, like getrandom or arc4random_buf. Thread
+/// safe without locks, fork safe and forward secure.
+/// @param buf output buffer
+/// @param n output buffer length
+void randquik_bytes(void* buf, size_t n) {
+    cha_fke_update(&_cha_tls_get()->fke, (uint8_t*)buf, n);
+}
+
+/// Fill the integer ret straight from the buffer when it has enough
+#define _CHA_TLS_DRAW(ret)                                                     \
+    {                                                                          \
+        cha_fke* f = &_cha_tls_get()->fke;                                     \
+        if (f->offset + sizeof ret <= CHA_FKE_SIZE) {                          \
+            memcpy(&ret, f->buf + f->offset, sizeof ret);                       \
+            memset(f->buf + f->offset, 0, sizeof ret);                          \
+            f->offset += sizeof ret;                                           \
+        } else                                                                 \
+            cha_fke_update(f, (uint8_t*)&ret, sizeof ret);                     \
+    }
+
+/// Random 64-bit integer, same guarantees as randquik_bytes
+uint64_t randquik_u64(void) {
+    uint64_t ret;
+    _CHA_TLS_DRAW(ret);
+    return ret;
+}
+
+/// Random 32-bit integer, same guarantees as randquik_bytes
+uint32_t randquik_u32(void) {
+    uint32_t ret;
+    _CHA_TLS_DRAW(ret);
+    return ret;
+}
+
+#undef _CHA_TLS_DRAW
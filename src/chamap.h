@@ -0,0 +1,194 @@
+#pragma once
+
+#include "charandom.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#if defined(__linux__)
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+/* The keystream as read-only memory of any size, generated on demand: the
+ * region is reserved without backing and a userfaultfd handler thread fills
+ * in each chunk at its first access, at the stream position equal to its
+ * offset. Only a bounded number of chunks stay resident, the earliest faulted
+ * are dropped first and simply generated again if read later. */
+
+#define CHA_MAP_CHUNK (1 << 18) // Generated per fault, a multiple of pages
+#define CHA_MAP_MAX (UINT64_C(1) << 57) // Largest size, the 5-level page table
+
+typedef struct cha_map {
+    uint8_t* data; // size bytes of keystream, read only (first for bindings)
+    uint64_t size;
+    cha_ctx ctx;
+    int64_t start; // cha_tell of ctx at offset 0, the counter of the iv
+    int uffd, wakefd[2];
+    uint64_t* resident; // Ring of chunks kept, eviction in fault order
+    size_t cached, nresident, next;
+    pthread_t thread;
+} cha_map;
+
+#if defined(__linux__)
+
+/// Generate chunk c into buf and map it, evicting the oldest when full
+static bool _cha_map_fill(cha_map* m, uint64_t c, uint8_t* buf) {
+    uint8_t* const dst = m->data + c * CHA_MAP_CHUNK;
+    cha_seek(&m->ctx, m->start + (int64_t)(c * CHA_MAP_CHUNK) - cha_tell(&m->ctx));
+    cha_update(&m->ctx, buf, CHA_MAP_CHUNK);
+    struct uffdio_copy copy = {
+      .dst = (uintptr_t)dst, .src = (uintptr_t)buf, .len = CHA_MAP_CHUNK
+    };
+    if (ioctl(m->uffd, UFFDIO_COPY, &copy) != 0) {
+        // Another page of the chunk faulted before it was mapped
+        if (errno != EEXIST)
+            return false;
+        struct uffdio_range range = {(uintptr_t)dst, CHA_MAP_CHUNK};
+        ioctl(m->uffd, UFFDIO_WAKE, &range);
+        return true;
+    }
+    if (m->nresident == m->cached) {
+        // Back to missing, so that another read faults it in again
+        madvise(m->data + m->resident[m->next] * CHA_MAP_CHUNK, CHA_MAP_CHUNK, MADV_DONTNEED);
+        --m->nresident;
+    }
+    m->resident[m->next] = c;
+    m->next = (m->next + 1) % m->cached;
+    ++m->nresident;
+    return true;
+}
+
+static void* _cha_map_thread(void* arg) {
+    cha_map* m = (cha_map*)arg;
+    uint8_t* buf = malloc(CHA_MAP_CHUNK);
+    struct pollfd fds[2] = {{m->uffd, POLLIN, 0}, {m->wakefd[0], POLLIN, 0}};
+    while (buf && poll(fds, 2, -1) >= 0 && !fds[1].revents) {
+        struct uffd_msg msg;
+        if (read(m->uffd, &msg, sizeof msg) != sizeof msg ||
+            msg.event != UFFD_EVENT_PAGEFAULT)
+            continue;
+        const uint64_t c = (msg.arg.pagefault.address - (uintptr_t)m->data) / CHA_MAP_CHUNK;
+        if (!_cha_map_fill(m, c, buf)) {
+            fprintf(stderr, "randquik: cha_map fault: %s\n", strerror(errno));
+            abort(); // The reader would otherwise be stuck forever
+        }
+    }
+    if (buf) {
+        memset(buf, 0, CHA_MAP_CHUNK);
+        free(buf);
+    }
+    return NULL;
+}
+
+static int _cha_userfaultfd(void) {
+    int fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+#ifdef UFFD_USER_MODE_ONLY
+    // Unprivileged processes may only handle their own faults, not those of
+    // the kernel, so that then system calls such as write cannot read the map
+    if (fd < 0 && errno == EPERM)
+        fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+#endif
+    struct uffdio_api api = {.api = UFFD_API};
+    if (fd >= 0 && ioctl(fd, UFFDIO_API, &api) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/// @brief Map size bytes of the stream of key and iv, generated as read.
+/// Reading the map at offset x gives the bytes of cha_seek(x) on the stream.
+/// Linux only (userfaultfd), limited by address space rather than memory.
+/// @param size length of the map up to CHA_MAP_MAX, need not be a multiple of
+/// pages
+/// @param cached chunks of CHA_MAP_CHUNK kept in memory, at least one
+/// @return the map, or NULL with errno if unsupported or out of memory
+cha_map* cha_map_create(
+  const uint8_t key[32], const uint8_t iv[16], unsigned rounds, uint64_t size,
+  size_t cached
+) {
+    if (!size || size > CHA_MAP_MAX || !cached) {
+        errno = EINVAL;
+        return NULL;
+    }
+    const uint64_t len = (size + CHA_MAP_CHUNK - 1) / CHA_MAP_CHUNK * CHA_MAP_CHUNK;
+    cha_map* m = calloc(1, sizeof *m);
+    if (!m)
+        return NULL;
+    m->size = size;
+    m->cached = cached;
+    m->uffd = -1;
+    m->wakefd[0] = m->wakefd[1] = -1;
+    m->resident = calloc(cached, sizeof *m->resident);
+    m->data = mmap(
+      NULL, len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+    );
+    if (m->data == MAP_FAILED)
+        m->data = NULL;
+    struct uffdio_register reg = {
+      .range = {(uintptr_t)m->data, len}, .mode = UFFDIO_REGISTER_MODE_MISSING
+    };
+    if (!m->resident || !m->data || (m->uffd = _cha_userfaultfd()) < 0 ||
+        ioctl(m->uffd, UFFDIO_REGISTER, &reg) != 0 || pipe(m->wakefd) != 0) {
+        const int err = errno;
+        if (m->uffd >= 0)
+            close(m->uffd);
+        if (m->data)
+            munmap(m->data, len);
+        free(m->resident);
+        free(m);
+        errno = err;
+        return NULL;
+    }
+    cha_init(&m->ctx, key, iv, rounds);
+    m->start = cha_tell(&m->ctx);
+    const int err = pthread_create(&m->thread, NULL, _cha_map_thread, m);
+    if (err) {
+        close(m->wakefd[0]);
+        close(m->wakefd[1]);
+        close(m->uffd);
+        munmap(m->data, len);
+        cha_wipe(&m->ctx);
+        free(m->resident);
+        free(m);
+        errno = err;
+        return NULL;
+    }
+    return m;
+}
+
+/// Unmap and free, no reads of the map may be in progress
+void cha_map_destroy(cha_map* m) {
+    const uint64_t len = (m->size + CHA_MAP_CHUNK - 1) / CHA_MAP_CHUNK * CHA_MAP_CHUNK;
+    while (write(m->wakefd[1], "", 1) < 0 && errno == EINTR) {}
+    pthread_join(m->thread, NULL);
+    close(m->wakefd[0]);
+    close(m->wakefd[1]);
+    close(m->uffd);
+    munmap(m->data, len);
+    cha_wipe(&m->ctx);
+    free(m->resident);
+    free(m);
+}
+
+#else
+
+cha_map* cha_map_create(
+  const uint8_t key[32], const uint8_t iv[16], unsigned rounds, uint64_t size,
+  size_t cached
+) {
+    (void)key;
+    (void)iv;
+    (void)rounds;
+    (void)size;
+    (void)cached;
+    errno = ENOSYS;
+    return NULL;
+}
+
+void cha_map_destroy(cha_map* m) { (void)m; }
+
+#endif
@@ -1,14 +1,75 @@
 #include "charandom.h"
+#include "chadist.h"
 
-static uint64_t cha_uint64(void* st) {
-    cha_ctx* ctx = (cha_ctx*)st;
-    if (ctx->offset + sizeof(uint64_t) > ctx->end) {
-        ctx->offset -= ctx->end;
-        ctx->end =
-          ctx->gen(ctx->unconsumed, BATCH_SIZE, ctx->state, ctx->rounds);
+/// Numpy bit generator state, draws are served from a larger buffer than the
+/// batch of cha_ctx so that the kernel runs on long stretches at a time.
+typedef struct cha_np {
+    cha_ctx ctx;     // Positioned after the buffer
+    uint8_t* buf;    // Refill buffer of bufsize bytes
+    uint32_t bufsize, offset, end;
+} cha_np;
+
+/// @brief Initialize with a caller allocated refill buffer
+/// @param bufsize Multiple of 8 bytes, preferably of BATCH_SIZE
+static void cha_np_init(
+  cha_np* st, const uint8_t* key, const uint8_t* iv, unsigned rounds,
+  uint8_t* buf, uint32_t bufsize
+) {
+    cha_init(&st->ctx, key, iv, rounds);
+    st->buf = buf;
+    st->bufsize = bufsize;
+    st->offset = st->end = 0;
+}
+
+/// Dispose of sensitive data, including the buffer
+static void cha_np_wipe(cha_np* st) {
+    if (st->buf)
+        memset(st->buf, 0, st->bufsize);
+    cha_wipe(&st->ctx);
+    st->offset = st->end = 0;
+}
+
+/// Byte position of the next draw
+static int64_t cha_np_tell(cha_np* st) {
+    return cha_tell(&st->ctx) - (int64_t)(st->end - st->offset);
+}
+
+/// Seek a number of bytes forward or backward, discarding the buffer
+static void cha_np_seek(cha_np* st, int64_t offset) {
+    cha_seek(&st->ctx, offset - (int64_t)(st->end - st->offset));
+    st->offset = st->end = 0;
+}
+
+/// Stream number held in the 64-bit nonce words
+static uint64_t cha_np_nonce(const cha_np* st) {
+    return st->ctx.state[14] | (uint64_t)st->ctx.state[15] << 32;
+}
+
+/// @brief Switch to another stream of the same key as src, from its start.
+/// Each nonce is its own 2^70 byte stream, disjoint from all others.
+static void cha_np_stream(cha_np* st, const cha_np* src, uint64_t nonce) {
+    memcpy(st->ctx.state, src->ctx.state, sizeof st->ctx.state);
+    st->ctx.state[12] = st->ctx.state[13] = 0;
+    st->ctx.state[14] = (uint32_t)nonce;
+    st->ctx.state[15] = (uint32_t)(nonce >> 32);
+    st->ctx.rounds = src->ctx.rounds;
+    st->ctx.gen = src->ctx.gen;
+    st->ctx.xgen = src->ctx.xgen;
+    st->ctx.batch = src->ctx.batch;
+    st->ctx.offset = st->ctx.end = 0;
+    st->offset = st->end = 0;
+}
+
+static uint64_t cha_uint64(void* s) {
+    cha_np* st = (cha_np*)s;
+    if (st->offset == st->end) {
+        cha_update(&st->ctx, st->buf, st->bufsize);
+        st->offset = 0;
+        st->end = st->bufsize;
     }
-    uint64_t ret = *(uint64_t*)(ctx->unconsumed + ctx->offset);
-    ctx->offset += sizeof(uint64_t);
+    uint64_t ret;
+    memcpy(&ret, st->buf + st->offset, sizeof ret);
+    st->offset += sizeof(uint64_t);
     return ret;
 }
 static uint32_t cha_uint32(void* st) { return cha_uint64(st); }
@@ -16,3 +77,48 @@ static double cha_double(void* st) {
     // Fast uint64_to_double conversion from numpy/random/_common.pxd
     return (cha_uint64(st) >> 11) * (1.0 / 9007199254740992.0);
 }
+
+// Bulk fills generate straight into the output with the SIMD kernel. They
+// always consume whole 64-bit words, as the draws above rely on that.
+
+/// Raw stream bytes, same as the bytes of len / 8 (rounded up) cha_uint64
+static void cha_fill_bytes(cha_np* st, void* out, size_t len) {
+    size_t whole = len & ~(size_t)7;
+    // Buffered words first
+    size_t N = st->end - st->offset;
+    if (N > whole)
+        N = whole;
+    memcpy(out, st->buf + st->offset, N);
+    st->offset += N;
+    cha_update(&st->ctx, (uint8_t*)out + N, whole - N);
+    if (len > whole) {
+        const uint64_t word = cha_uint64(st);
+        memcpy((uint8_t*)out + whole, &word, len - whole);
+    }
+}
+
+static void _cha_np_source(void* st, void* out, size_t len) {
+    cha_fill_bytes((cha_np*)st, out, len);
+}
+
+/// Same as n calls of cha_double
+static void cha_fill_double(cha_np* st, double* out, size_t n) {
+    _cha_uniform_f64(st, _cha_np_source, out, n);
+}
+
+/// Floats in [0, 1) from 32-bit halves of the stream words
+static void cha_fill_float(cha_np* st, float* out, size_t n) {
+    _cha_uniform_f32(st, _cha_np_source, out, n);
+}
+
+/// Integers in [0, bound) from 32-bit halves of the stream words
+static void cha_fill_bounded(
+  cha_np* st, uint32_t* out, size_t n, uint32_t bound
+) {
+    _cha_bounded_u32(st, _cha_np_source, out, n, bound);
+}
+
+/// Standard normal doubles by Ziggurat
+static void cha_fill_normal(cha_np* st, double* out, size_t n) {
+    _cha_normal_f64(st, _cha_np_source, out, n);
+}
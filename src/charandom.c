@@ -1,3 +1,6 @@
-#include "chacha20.h"
+#include "charandom.h"
+#include "chadist.h"
+#include "chaglobal.h"
+#include "chamap.h"
 
 // Library build for Python CFFI to use
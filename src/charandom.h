@@ -1,20 +1,106 @@
+#pragma once
+
 #include <stdbool.h>
 #include <stdint.h>
 
 #define CHA_BLOCK_SIZE 64
-#define BATCH_BLOCKS 8
+#define BATCH_BLOCKS 16 // Largest kernel batch (AVX-512)
 #define BATCH_SIZE (BATCH_BLOCKS * CHA_BLOCK_SIZE)
 
-#if defined(__x86_64__)
+// Kernel bodies are instantiated for plain output and for XOR with input,
+// for any round count and specialised for 8, 12 and 20 rounds
 #ifdef __GNUC__
-#pragma GCC target("sse2")
-#pragma GCC target("ssse3")
-#pragma GCC target("avx2")
+#define CHA_INLINE static inline __attribute__((always_inline))
+#define CHA_UNROLL _Pragma("GCC unroll 10")
+#else
+#define CHA_INLINE static inline
+#define CHA_UNROLL
+#endif
+
+#define _CHA_GEN(kernel, name, R)                                              \
+    static inline uint64_t name(                                               \
+      uint8_t* buf, size_t bufsize, uint32_t state[16], unsigned rounds         \
+    ) {                                                                        \
+        (void)rounds;                                                          \
+        return kernel##_impl(buf, NULL, bufsize, state, R);                    \
+    }
+#define _CHA_XOR(kernel, name, R)                                              \
+    static inline uint64_t name(                                               \
+      uint8_t* buf, const uint8_t* in, size_t bufsize, uint32_t state[16],      \
+      unsigned rounds                                                          \
+    ) {                                                                        \
+        (void)rounds;                                                          \
+        return kernel##_impl(buf, in, bufsize, state, R);                      \
+    }
+#define CHA_INSTANCES(kernel)                                                  \
+    _CHA_GEN(kernel, kernel, rounds)                                           \
+    _CHA_GEN(kernel, kernel##_r8, 8)                                           \
+    _CHA_GEN(kernel, kernel##_r12, 12)                                         \
+    _CHA_GEN(kernel, kernel##_r20, 20)                                         \
+    _CHA_XOR(kernel, kernel##_xor, rounds)                                     \
+    _CHA_XOR(kernel, kernel##_xor_r8, 8)                                       \
+    _CHA_XOR(kernel, kernel##_xor_r12, 12)                                     \
+    _CHA_XOR(kernel, kernel##_xor_r20, 20)
+
+// Lane kernels for cha_generate_multi, one block of a separate stream a lane
+#define _CHA_MULTI(kernel, name, R)                                            \
+    static inline void name(                                                   \
+      uint8_t* const* dst, uint32_t* lanes, unsigned rounds                    \
+    ) {                                                                        \
+        (void)rounds;                                                          \
+        kernel##_impl(dst, lanes, R);                                          \
+    }
+#define CHA_MULTI_INSTANCES(kernel)                                            \
+    _CHA_MULTI(kernel, kernel, rounds)                                         \
+    _CHA_MULTI(kernel, kernel##_r8, 8)                                         \
+    _CHA_MULTI(kernel, kernel##_r12, 12)                                       \
+    _CHA_MULTI(kernel, kernel##_r20, 20)
+
+// Each SIMD kernel is compiled for its own instruction set only, so that a
+// generic build runs anywhere and dispatches at runtime (see cha_init)
+#define _CHA_PRAGMA(x) _Pragma(#x)
+#if defined(__clang__)
+#define CHA_TARGET_BEGIN(isa)                                                  \
+    _CHA_PRAGMA(clang attribute push(__attribute__((target(isa))), apply_to = function))
+#define CHA_TARGET_END _CHA_PRAGMA(clang attribute pop)
+#elif defined(__GNUC__)
+#define CHA_TARGET_BEGIN(isa) _CHA_PRAGMA(GCC push_options) _CHA_PRAGMA(GCC target(isa))
+#define CHA_TARGET_END _CHA_PRAGMA(GCC pop_options)
+#else
+#define CHA_TARGET_BEGIN(isa)
+#define CHA_TARGET_END
 #endif
+
+#if defined(__x86_64__)
+// Intrinsic headers set their own targets, include them outside of ours
+#include <immintrin.h>
+CHA_TARGET_BEGIN("ssse3")
 #include "cha4ssse3.h"
+CHA_TARGET_END
+CHA_TARGET_BEGIN("avx2")
 #include "cha8avx2.h"
+// Only a win with the 32 registers of AVX-512VL, which are not enabled by
+// the avx2 target alone but by the build flags (-march=native)
+#ifdef __AVX512VL__
+#define CHA_AVX2X2
+#include "cha16avx2.h"
+#endif
+CHA_TARGET_END
+CHA_TARGET_BEGIN("avx512f")
+#include "cha16avx512.h"
+CHA_TARGET_END
 #elif defined(__aarch64__)
 #include "cha4neon.h"
+#include "cha8neon.h"
+// SVE2 is detected at runtime on Linux; define CHA_NO_SVE2 for compilers
+// that cannot build it
+#if defined(__linux__) && !defined(CHA_NO_SVE2)
+#define CHA_SVE2
+#include <sys/auxv.h>
+CHA_TARGET_BEGIN("+sve2")
+#include "chasve2.h"
+CHA_TARGET_END
+#endif
 #endif
 
 #include "cha1c.h"
@@ -23,6 +109,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <pthread.h>
@@ -32,14 +119,150 @@
 typedef uint64_t (*genfunc)(
   uint8_t* out, size_t outsize, uint32_t state[16], unsigned rounds
 );
+typedef uint64_t (*xorfunc)(
+  uint8_t* out, const uint8_t* in, size_t outsize, uint32_t state[16],
+  unsigned rounds
+);
 typedef struct cha_ctx {
     uint32_t state[16];
     uint8_t unconsumed[BATCH_SIZE];
     uint32_t offset, end;
+    uint32_t batch; // Bytes per kernel batch, the refill of unconsumed
     unsigned rounds;
     genfunc gen;
+    xorfunc xgen; // Same kernel, XORing the keystream into input
 } cha_ctx;
 
+/// A SIMD kernel in its generic and round specialised instances
+typedef struct cha_kernel {
+    const char* name;
+    unsigned batch; // Bytes per batch, or BATCH_SIZE if only known at runtime
+    genfunc gen, gen8, gen12, gen20;
+    xorfunc xgen, xgen8, xgen12, xgen20;
+} cha_kernel;
+
+#define CHA_KERNEL(name, kernel, blocks)                                       \
+    {                                                                          \
+        name, (blocks) * CHA_BLOCK_SIZE, kernel, kernel##_r8, kernel##_r12, kernel##_r20, kernel##_xor,   \
+          kernel##_xor_r8, kernel##_xor_r12, kernel##_xor_r20                  \
+    }
+
+// Fastest first
+static const cha_kernel cha_kernels[] = {
+#if defined(__x86_64__)
+  CHA_KERNEL("avx512", _cha_16block, 16),
+  CHA_KERNEL("avx2", _cha_8block, 8),
+#ifdef CHA_AVX2X2
+  CHA_KERNEL("avx2x2", _cha_16block_avx2, 16),
+#endif
+  CHA_KERNEL("ssse3", _cha_4block, 4),
+#elif defined(__aarch64__)
+  CHA_KERNEL("neon8", _cha_8block_neon, 8),
+#ifdef CHA_SVE2
+  CHA_KERNEL("sve2", _cha_sve2, BATCH_BLOCKS),
+#endif
+  CHA_KERNEL("neon", _cha_4block, 4),
+#endif
+  CHA_KERNEL("c", _cha_block, 1),
+};
+
+static bool _cha_kernel_supported(const cha_kernel* k) {
+#if defined(__x86_64__)
+    if (k->gen == _cha_16block)
+        return __builtin_cpu_supports("avx512f");
+#ifdef CHA_AVX2X2
+    if (k->gen == _cha_16block_avx2)
+        return __builtin_cpu_supports("avx512vl");
+#endif
+    if (k->gen == _cha_8block)
+        return __builtin_cpu_supports("avx2");
+    if (k->gen == _cha_4block)
+        return __builtin_cpu_supports("ssse3");
+#elif defined(CHA_SVE2)
+#ifndef HWCAP2_SVE2
+#define HWCAP2_SVE2 (1 << 1)
+#endif
+    if (k->gen == _cha_sve2)
+        return getauxval(AT_HWCAP2) & HWCAP2_SVE2;
+#endif
+    return true;
+}
+
+/// Use kernel k, an instance specialised for the round count if there is one
+static void _cha_use_kernel(cha_ctx* ctx, const cha_kernel* k) {
+    ctx->batch = k->batch;
+    switch (ctx->rounds) {
+    case 8: ctx->gen = k->gen8, ctx->xgen = k->xgen8; break;
+    case 12: ctx->gen = k->gen12, ctx->xgen = k->xgen12; break;
+    case 20: ctx->gen = k->gen20, ctx->xgen = k->xgen20; break;
+    default: ctx->gen = k->gen, ctx->xgen = k->xgen;
+    }
+}
+
+// Kernel used by all contexts, chosen once per process
+static const cha_kernel* _cha_kernel;
+static pthread_once_t _cha_kernel_once = PTHREAD_ONCE_INIT;
+
+static double _cha_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/// Seconds for a few KB, best of several runs after a warm-up
+static double _cha_kernel_time(const cha_kernel* k) {
+    uint8_t buf[4 * BATCH_SIZE];
+    uint32_t state[16] = {0};
+    double best = 1e9;
+    for (int i = 0; i < 6; ++i) {
+        const double t = _cha_now();
+        k->gen20(buf, sizeof buf, state, 20);
+        const double dt = _cha_now() - t;
+        if (i && dt < best)
+            best = dt;
+    }
+    return best;
+}
+
+/// RANDQUIK_KERNEL=name if set and supported, otherwise the fastest kernel
+/// by micro-benchmark, or the first supported with CHA_NO_CALIBRATE
+static void _cha_kernel_select(void) {
+    const size_t n = sizeof cha_kernels / sizeof *cha_kernels;
+    const char* name = getenv("RANDQUIK_KERNEL");
+    for (size_t i = 0; name && i < n; ++i) {
+        if (!strcmp(name, cha_kernels[i].name) &&
+            _cha_kernel_supported(&cha_kernels[i])) {
+            _cha_kernel = &cha_kernels[i];
+            return;
+        }
+    }
+    double best = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        const cha_kernel* k = &cha_kernels[i];
+        if (!_cha_kernel_supported(k))
+            continue;
+#ifdef CHA_NO_CALIBRATE
+        _cha_kernel = k;
+        return;
+#endif
+        // Table order wins unless another kernel is clearly faster
+        const double t = _cha_kernel_time(k);
+        if (!_cha_kernel || t < 0.95 * best)
+            _cha_kernel = k, best = t;
+    }
+}
+
+/// Name of the kernel in use by the context, e.g. "avx2"
+const char* cha_kernel_name(const cha_ctx* ctx) {
+    for (size_t i = 0; i < sizeof cha_kernels / sizeof *cha_kernels; ++i) {
+        const cha_kernel* k = &cha_kernels[i];
+        if (ctx->gen == k->gen || ctx->gen == k->gen8 ||
+            ctx->gen == k->gen12 || ctx->gen == k->gen20)
+            return k->name;
+    }
+    return "unknown";
+}
+
 /// @brief Initialize cha_ctx
 /// @param ctx holds ChaCha20 state
 /// @param key 32 byte key
@@ -57,18 +280,8 @@ void cha_init(
     memset(ctx->unconsumed, 0, sizeof ctx->unconsumed);
     ctx->offset = ctx->end = 0;
     ctx->rounds = rounds;
-#if defined(__x86_64__)
-    if (__builtin_cpu_supports("avx2"))
-        ctx->gen = _cha_8block;
-    else if (__builtin_cpu_supports("ssse3"))
-        ctx->gen = _cha_4block;
-    else
-        ctx->gen = _cha_block;
-#elif defined(__aarch64__)
-    ctx->gen = _cha_4block;
-#else
-    ctx->gen = _cha_block;
-#endif
+    pthread_once(&_cha_kernel_once, _cha_kernel_select);
+    _cha_use_kernel(ctx, _cha_kernel);
 }
 
 /// Dispose of sensitive data within the context
@@ -102,6 +315,12 @@ int64_t cha_tell(cha_ctx* ctx) {
     return counter * CHA_BLOCK_SIZE + ctx->offset - ctx->end;
 }
 
+/// Refill unconsumed with a single kernel batch, which is all that a tail
+/// (shorter than a batch) needs and the lowest latency for short reads.
+static void _cha_refill(cha_ctx* ctx) {
+    ctx->end = ctx->gen(ctx->unconsumed, ctx->batch, ctx->state, ctx->rounds);
+}
+
 /// @brief Incremental generation, keeps state between calls
 /// @param ctx ChaCha context
 /// @param out output buffer
@@ -112,8 +331,7 @@ void cha_update(cha_ctx* ctx, uint8_t* out, uint64_t outlen) {
     if (ctx->offset) {
         // Need to generate stored buffer?
         if (ctx->end == 0)
-            ctx->end =
-              ctx->gen(ctx->unconsumed, BATCH_SIZE, ctx->state, ctx->rounds);
+            _cha_refill(ctx);
         // Deliver stored bytes first
         uint64_t N = ctx->end - ctx->offset;
         if (N > outlen)
@@ -126,16 +344,121 @@ void cha_update(cha_ctx* ctx, uint8_t* out, uint64_t outlen) {
         if (out == end)
             return;
     }
-    out += ctx->gen(out, end - out, ctx->state, ctx->rounds);
+    if (end - out >= ctx->batch)
+        out += ctx->gen(out, end - out, ctx->state, ctx->rounds);
     const uint32_t N = end - out;
     if (N) {
-        ctx->end =
-          ctx->gen(ctx->unconsumed, BATCH_SIZE, ctx->state, ctx->rounds);
+        _cha_refill(ctx);
         memcpy(out, ctx->unconsumed, N);
         ctx->offset = N;
     }
 }
 
+/// Next 8 bytes of the stream as a native endian integer
+uint64_t cha_u64(cha_ctx* ctx) {
+    uint64_t ret;
+    if (ctx->offset + sizeof ret > ctx->end) {
+        cha_update(ctx, (uint8_t*)&ret, sizeof ret);
+        return ret;
+    }
+    memcpy(&ret, ctx->unconsumed + ctx->offset, sizeof ret); // A single load
+    ctx->offset += sizeof ret;
+    if (ctx->offset == ctx->end)
+        ctx->offset = ctx->end = 0;
+    return ret;
+}
+
+/// Next 4 bytes of the stream as a native endian integer
+uint32_t cha_u32(cha_ctx* ctx) {
+    uint32_t ret;
+    if (ctx->offset + sizeof ret > ctx->end) {
+        cha_update(ctx, (uint8_t*)&ret, sizeof ret);
+        return ret;
+    }
+    memcpy(&ret, ctx->unconsumed + ctx->offset, sizeof ret);
+    ctx->offset += sizeof ret;
+    if (ctx->offset == ctx->end)
+        ctx->offset = ctx->end = 0;
+    return ret;
+}
+
+/// @brief Uniform integer in [0, n) without modulo bias, 0 if n is 0.
+/// Lemire's multiply and shift, which rarely needs a division or a redraw.
+uint64_t cha_bounded(cha_ctx* ctx, uint64_t n) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t m = (__uint128_t)cha_u64(ctx) * n;
+    if ((uint64_t)m < n) {
+        const uint64_t threshold = -n % n;
+        while ((uint64_t)m < threshold) m = (__uint128_t)cha_u64(ctx) * n;
+    }
+    return m >> 64;
+#else
+    if (n == 0)
+        return 0;
+    const uint64_t threshold = -n % n;
+    uint64_t x;
+    do x = cha_u64(ctx);
+    while (x < threshold);
+    return x % n;
+#endif
+}
+
+static void _cha_xor_bytes(
+  uint8_t* out, const uint8_t* in, const uint8_t* key, uint32_t n
+) {
+    for (uint32_t i = 0; i < n; ++i) out[i] = in[i] ^ key[i];
+}
+
+/// @brief Encrypt or decrypt: XOR the keystream into input, in a single pass
+/// over memory. Advances the stream the same as cha_update.
+/// @param ctx ChaCha context
+/// @param in input buffer
+/// @param out output buffer, may be the same as in (not partially overlapping)
+/// @param len length of both buffers
+void cha_xor_update(
+  cha_ctx* ctx, const uint8_t* in, uint8_t* out, uint64_t len
+) {
+    uint8_t* end = out + len;
+    if (ctx->offset) {
+        if (ctx->end == 0)
+            _cha_refill(ctx);
+        uint64_t N = ctx->end - ctx->offset;
+        if (N > len)
+            N = len;
+        _cha_xor_bytes(out, in, ctx->unconsumed + ctx->offset, N);
+        ctx->offset += N;
+        out += N;
+        in += N;
+        if (ctx->offset == ctx->end)
+            ctx->offset = ctx->end = 0;
+        if (out == end)
+            return;
+    }
+    if (end - out >= ctx->batch) {
+        const uint64_t bulk =
+          ctx->xgen(out, in, end - out, ctx->state, ctx->rounds);
+        out += bulk;
+        in += bulk;
+    }
+    const uint32_t N = end - out;
+    if (N) {
+        _cha_refill(ctx);
+        _cha_xor_bytes(out, in, ctx->unconsumed, N);
+        ctx->offset = N;
+    }
+}
+
+/// @brief Fill several buffers in turn, same as cha_update on each of them
+/// @param ctx ChaCha context
+/// @param outs output buffers
+/// @param lens output buffer lengths
+/// @param n number of buffers
+void cha_update_many(
+  cha_ctx* ctx, uint8_t* const* outs, const uint64_t* lens, size_t n
+) {
+    for (size_t i = 0; i < n; ++i) cha_update(ctx, outs[i], lens[i]);
+}
+
 /// @brief Produce a requested number of random bytes, single shot.
 /// @param out output buffer
 /// @param outlen output buffer length
@@ -150,3 +473,463 @@ void cha_generate(
     cha_update(&ctx, out, outlen);
     cha_wipe(&ctx);
 }
+
+typedef void (*multifunc)(uint8_t* const* dst, uint32_t* lanes, unsigned rounds);
+
+#define CHA_MULTI_LANES 16 // Most streams a lane kernel takes at once
+
+/// Lane kernel matching the kernel in use, specialised for the rounds, or NULL
+static multifunc _cha_multi_kernel(unsigned rounds, unsigned* lanes) {
+    pthread_once(&_cha_kernel_once, _cha_kernel_select);
+#if defined(__x86_64__)
+    const cha_kernel* k = _cha_kernel;
+    if (k->gen == _cha_16block) {
+        *lanes = 16;
+        return rounds == 8 ? _cha_16block_multi_r8 : rounds == 12 ? _cha_16block_multi_r12
+             : rounds == 20 ? _cha_16block_multi_r20 : _cha_16block_multi;
+    }
+    bool avx2 = k->gen == _cha_8block;
+#ifdef CHA_AVX2X2
+    avx2 |= k->gen == _cha_16block_avx2;
+#endif
+    if (avx2) {
+        *lanes = 8;
+        return rounds == 8 ? _cha_8block_multi_r8 : rounds == 12 ? _cha_8block_multi_r12
+             : rounds == 20 ? _cha_8block_multi_r20 : _cha_8block_multi;
+    }
+#endif
+    return NULL;
+}
+
+/// @brief Many independent short streams, as cha_generate on each, computed
+/// together with each SIMD lane on a different stream. Lanes take the next
+/// stream as soon as theirs is complete, so mixed lengths keep all busy.
+/// @param outs output buffers
+/// @param lens output buffer lengths
+/// @param keys n keys of 32 bytes, one after another
+/// @param ivs n IVs of 16 bytes, one after another
+/// @param n number of streams
+void cha_generate_multi(
+  uint8_t* const* outs, const uint64_t* lens, const uint8_t* keys,
+  const uint8_t* ivs, size_t n, unsigned rounds
+) {
+    unsigned nlanes;
+    const multifunc gen = _cha_multi_kernel(rounds, &nlanes);
+    if (!gen) {
+        for (size_t i = 0; i < n; ++i)
+            cha_generate(outs[i], lens[i], keys + 32 * i, ivs + 16 * i, rounds);
+        return;
+    }
+    uint32_t lanes[16 * CHA_MULTI_LANES] = {}; // Word i of lane j at i * nlanes + j
+    uint8_t scratch[CHA_MULTI_LANES][CHA_BLOCK_SIZE]; // Partial and idle blocks
+    uint8_t* dst[CHA_MULTI_LANES];
+    size_t stream[CHA_MULTI_LANES]; // Index of the stream of each lane, or n
+    uint64_t pos[CHA_MULTI_LANES];
+    size_t next = 0;
+    unsigned active = 0;
+    for (unsigned j = 0; j < nlanes; ++j) stream[j] = n;
+    for (;;) {
+        for (unsigned j = 0; j < nlanes; ++j) {
+            if (stream[j] == n) {
+                // Lane free to take the next stream that wants any output
+                while (next < n && !lens[next]) ++next;
+                if (next < n) {
+                    uint32_t state[16] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+                    memcpy(state + 4, keys + 32 * next, 32);
+                    memcpy(state + 12, ivs + 16 * next, 16);
+                    for (unsigned i = 0; i < 16; ++i) lanes[i * nlanes + j] = state[i];
+                    memset(state, 0, sizeof state);
+                    stream[j] = next++;
+                    pos[j] = 0;
+                    ++active;
+                }
+            }
+            const size_t s = stream[j];
+            dst[j] = s < n && lens[s] - pos[j] >= CHA_BLOCK_SIZE ? outs[s] + pos[j]
+                                                                 : scratch[j];
+        }
+        if (!active)
+            break;
+        gen(dst, lanes, rounds);
+        for (unsigned j = 0; j < nlanes; ++j) {
+            const size_t s = stream[j];
+            if (s == n)
+                continue;
+            const uint64_t left = lens[s] - pos[j];
+            if (left < CHA_BLOCK_SIZE)
+                memcpy(outs[s] + pos[j], scratch[j], left);
+            pos[j] += CHA_BLOCK_SIZE;
+            if (pos[j] >= lens[s]) {
+                stream[j] = n;
+                --active;
+            }
+        }
+    }
+    memset(lanes, 0, sizeof lanes);
+    memset(scratch, 0, sizeof scratch);
+}
+
+/* Fast-key-erasure (Bernstein): each batch begins with the key of the next,
+ * which overwrites the current key at once, and output bytes are wiped from
+ * the buffer as they are handed out. A disclosure of the state then reveals
+ * neither past output nor, once the next batch is made, any others. */
+
+#define CHA_FKE_SIZE 16384 // Batch per key, 32 bytes of which are the next key
+
+typedef struct cha_fke {
+    cha_ctx ctx; // Key and kernel only, its own buffer is unused
+    uint32_t offset; // Bytes before it in buf have been served and wiped
+    uint8_t buf[CHA_FKE_SIZE];
+} cha_fke;
+
+/// New batch into buf, new key from its first bytes
+static void _cha_fke_refill(cha_fke* f) {
+    cha_ctx* c = &f->ctx;
+    c->state[12] = c->state[13] = 0;
+    c->gen(f->buf, CHA_FKE_SIZE, c->state, c->rounds);
+    memcpy(c->state + 4, f->buf, 32);
+    memset(f->buf, 0, 32);
+    f->offset = 32;
+}
+
+/// @brief Initialize a forward secure generator, erasing the seed key from
+/// its state before the first output
+/// @param f holds the generator state
+/// @param key 32 byte key, e.g. from getrandom, which the caller should wipe
+/// @param rounds ChaCha iteration count: 8=fast, 12=balanced, 20=secure
+void cha_fke_init(cha_fke* f, const uint8_t* key, unsigned rounds) {
+    cha_init(&f->ctx, key, (const uint8_t[16]){0}, rounds);
+    _cha_fke_refill(f);
+}
+
+/// @brief Random bytes with fast-key-erasure. Requests of a batch or more
+/// are generated straight into out, under a key that is replaced afterwards.
+/// @param f forward secure generator
+/// @param out output buffer
+/// @param outlen output buffer length
+void cha_fke_update(cha_fke* f, uint8_t* out, uint64_t outlen) {
+    cha_ctx* c = &f->ctx;
+    while (outlen) {
+        if (f->offset == CHA_FKE_SIZE) {
+            if (outlen >= CHA_FKE_SIZE) {
+                // The next key in buf, then the rest of this key into out
+                c->state[12] = c->state[13] = 0;
+                c->gen(f->buf, c->batch, c->state, c->rounds);
+                const uint64_t N = c->gen(out, outlen, c->state, c->rounds);
+                memcpy(c->state + 4, f->buf, 32);
+                memset(f->buf, 0, c->batch);
+                out += N;
+                outlen -= N;
+                if (!outlen)
+                    return;
+            }
+            _cha_fke_refill(f);
+        }
+        uint64_t N = CHA_FKE_SIZE - f->offset;
+        if (N > outlen)
+            N = outlen;
+        memcpy(out, f->buf + f->offset, N);
+        memset(f->buf + f->offset, 0, N);
+        f->offset += N;
+        out += N;
+        outlen -= N;
+    }
+}
+
+/// Dispose of the key and any unserved output
+void cha_fke_wipe(cha_fke* f) { memset(f, 0, sizeof(cha_fke)); }
+
+/// Worker threads for generating large outputs on several cores
+typedef struct cha_pool {
+    unsigned nthreads; // Including the calling thread
+    pthread_t* threads;
+    pthread_mutex_t busy; // Held by the caller for the duration of a job
+    pthread_mutex_t lock; // Protects the fields below
+    pthread_cond_t start, finish;
+    uint64_t generation; // Incremented for each job
+    unsigned running;    // Helper threads still working on the job
+    bool quit;
+    // Current job, split in chunks of whole batches
+    const cha_ctx* ctx;
+    uint8_t* out;
+    uint64_t outlen, chunk, next;
+} cha_pool;
+
+// Below this, splitting the work costs more than it gains
+#define CHA_PARALLEL_MIN (1 << 18)
+
+static void _cha_pool_work(cha_pool* pool) {
+    cha_ctx ctx = *pool->ctx;
+    uint64_t pos = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        const uint64_t start = pool->next;
+        pool->next += pool->chunk;
+        pthread_mutex_unlock(&pool->lock);
+        if (start >= pool->outlen)
+            break;
+        uint64_t n = pool->outlen - start;
+        if (n > pool->chunk)
+            n = pool->chunk;
+        cha_seek_blocks(&ctx, (start - pos) / CHA_BLOCK_SIZE);
+        cha_update(&ctx, pool->out + start, n);
+        pos = start + n;
+    }
+    cha_wipe(&ctx);
+}
+
+static void* _cha_pool_thread(void* arg) {
+    cha_pool* pool = (cha_pool*)arg;
+    uint64_t generation = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == generation && !pool->quit)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->quit)
+            break;
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        _cha_pool_work(pool);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->finish);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/// @brief Create a reusable pool for cha_update_parallel
+/// @param nthreads Total threads including the caller, 0 for all CPUs
+/// @return The pool, or NULL if out of memory
+cha_pool* cha_pool_create(unsigned nthreads) {
+    if (nthreads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 0 ? cpus : 1;
+    }
+    cha_pool* pool = calloc(1, sizeof(cha_pool));
+    if (!pool)
+        return NULL;
+    pool->threads = calloc(nthreads, sizeof(pthread_t));
+    if (!pool->threads) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->busy, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->finish, NULL);
+    pool->nthreads = 1;
+    while (pool->nthreads < nthreads &&
+           pthread_create(
+             &pool->threads[pool->nthreads - 1], NULL, _cha_pool_thread, pool
+           ) == 0)
+        ++pool->nthreads;
+    return pool;
+}
+
+/// Stop the threads and free the pool
+void cha_pool_destroy(cha_pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (unsigned i = 0; i < pool->nthreads - 1; ++i)
+        pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->busy);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->finish);
+    free(pool->threads);
+    free(pool);
+}
+
+/// @brief Same as cha_update but large outputs are split between the threads
+/// of the pool, giving identical output. A pool may be shared by many
+/// callers, jobs then run one at a time.
+/// @param pool Thread pool from cha_pool_create
+/// @param ctx ChaCha context
+/// @param out output buffer
+/// @param outlen output buffer length
+void cha_update_parallel(
+  cha_pool* pool, cha_ctx* ctx, uint8_t* out, uint64_t outlen
+) {
+    // Deliver stored bytes first, so that the rest starts at a batch boundary
+    if (ctx->offset) {
+        uint64_t N = (ctx->end ? ctx->end : BATCH_SIZE) - ctx->offset;
+        if (N > outlen)
+            N = outlen;
+        cha_update(ctx, out, N);
+        out += N;
+        outlen -= N;
+    }
+    const uint64_t bulk = outlen / BATCH_SIZE * BATCH_SIZE;
+    if (pool->nthreads > 1 && bulk >= CHA_PARALLEL_MIN) {
+        // A few chunks per thread for balancing, each whole batches
+        uint64_t chunk = bulk / (4 * pool->nthreads);
+        chunk = (chunk + BATCH_SIZE - 1) / BATCH_SIZE * BATCH_SIZE;
+        pthread_mutex_lock(&pool->busy);
+        pthread_mutex_lock(&pool->lock);
+        pool->ctx = ctx;
+        pool->out = out;
+        pool->outlen = bulk;
+        pool->chunk = chunk;
+        pool->next = 0;
+        pool->running = pool->nthreads - 1;
+        ++pool->generation;
+        pthread_cond_broadcast(&pool->start);
+        pthread_mutex_unlock(&pool->lock);
+        _cha_pool_work(pool);
+        pthread_mutex_lock(&pool->lock);
+        while (pool->running)
+            pthread_cond_wait(&pool->finish, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+        pthread_mutex_unlock(&pool->busy);
+        cha_seek_blocks(ctx, bulk / CHA_BLOCK_SIZE);
+        out += bulk;
+        outlen -= bulk;
+    }
+    cha_update(ctx, out, outlen);
+}
+
+/// @brief Produce a requested number of random bytes on several threads.
+/// Output is identical to cha_generate. Threads are started for this call
+/// only; keep a cha_pool and use cha_update_parallel for repeated calls.
+/// @param out output buffer
+/// @param outlen output buffer length
+/// @param key 32 byte key
+/// @param iv 16 bytes, where normally initial 4-8 bytes are 0 (counter)
+/// @param nthreads Number of threads to use, 0 for all CPUs
+void cha_generate_parallel(
+  uint8_t* out, uint64_t outlen, const uint8_t key[32], const uint8_t iv[16],
+  unsigned rounds, unsigned nthreads
+) {
+    cha_ctx ctx;
+    cha_init(&ctx, key, iv, rounds);
+    cha_pool* pool = NULL;
+    if (outlen >= CHA_PARALLEL_MIN && nthreads != 1)
+        pool = cha_pool_create(nthreads);
+    if (pool) {
+        cha_update_parallel(pool, &ctx, out, outlen);
+        cha_pool_destroy(pool);
+    } else {
+        cha_update(&ctx, out, outlen);
+    }
+    cha_wipe(&ctx);
+}
+
+/// Stream generated ahead on a helper thread into a ring of buffers, so that
+/// reads are normally only a copy. Each drained buffer is refilled at once.
+typedef struct cha_prefetch {
+    cha_ctx ctx; // Helper's position, ready bytes ahead of the reader
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled, drained;
+    uint8_t* bufs;
+    uint64_t bufsize, offset; // Bytes per buffer, read of the head buffer
+    unsigned nbufs, head, ready; // Head buffer and the filled ones from it
+    bool quit;
+} cha_prefetch;
+
+static void* _cha_prefetch_thread(void* arg) {
+    cha_prefetch* p = (cha_prefetch*)arg;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (p->ready == p->nbufs && !p->quit)
+            pthread_cond_wait(&p->drained, &p->lock);
+        if (p->quit)
+            break;
+        // The reader only touches ready buffers, so fill without the lock
+        uint8_t* buf = p->bufs + (p->head + p->ready) % p->nbufs * p->bufsize;
+        pthread_mutex_unlock(&p->lock);
+        cha_update(&p->ctx, buf, p->bufsize);
+        pthread_mutex_lock(&p->lock);
+        ++p->ready;
+        pthread_cond_signal(&p->filled);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+/// @brief Start prefetching the stream of ctx from its current position
+/// @param ctx ChaCha context, copied and not advanced
+/// @param nbufs Number of buffers, at least 2 so that one fills while
+/// another is read
+/// @param bufsize Bytes per buffer, e.g. the largest read expected
+/// @return The prefetcher, or NULL if out of memory or threads
+cha_prefetch* cha_prefetch_create(
+  const cha_ctx* ctx, unsigned nbufs, uint64_t bufsize
+) {
+    if (nbufs < 2)
+        nbufs = 2;
+    if (bufsize < BATCH_SIZE)
+        bufsize = BATCH_SIZE;
+    cha_prefetch* p = calloc(1, sizeof(cha_prefetch));
+    if (!p)
+        return NULL;
+    p->bufs = malloc(nbufs * bufsize);
+    if (!p->bufs) {
+        free(p);
+        return NULL;
+    }
+    p->ctx = *ctx;
+    p->nbufs = nbufs;
+    p->bufsize = bufsize;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->filled, NULL);
+    pthread_cond_init(&p->drained, NULL);
+    if (pthread_create(&p->thread, NULL, _cha_prefetch_thread, p)) {
+        pthread_mutex_destroy(&p->lock);
+        pthread_cond_destroy(&p->filled);
+        pthread_cond_destroy(&p->drained);
+        cha_wipe(&p->ctx);
+        free(p->bufs);
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+/// @brief Same output as cha_update on the context it was created from,
+/// waiting only if the reader gets ahead of the helper thread
+/// @param p Prefetcher
+/// @param out output buffer
+/// @param outlen output buffer length
+void cha_prefetch_update(cha_prefetch* p, uint8_t* out, uint64_t outlen) {
+    pthread_mutex_lock(&p->lock);
+    while (outlen) {
+        while (!p->ready) pthread_cond_wait(&p->filled, &p->lock);
+        pthread_mutex_unlock(&p->lock);
+        const uint8_t* buf = p->bufs + p->head * p->bufsize;
+        uint64_t N = p->bufsize - p->offset;
+        if (N > outlen)
+            N = outlen;
+        memcpy(out, buf + p->offset, N);
+        p->offset += N;
+        out += N;
+        outlen -= N;
+        pthread_mutex_lock(&p->lock);
+        if (p->offset == p->bufsize) {
+            p->offset = 0;
+            p->head = (p->head + 1) % p->nbufs;
+            --p->ready;
+            pthread_cond_signal(&p->drained);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+/// Stop the helper thread, wipe and free
+void cha_prefetch_destroy(cha_prefetch* p) {
+    pthread_mutex_lock(&p->lock);
+    p->quit = true;
+    pthread_cond_signal(&p->drained);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->filled);
+    pthread_cond_destroy(&p->drained);
+    memset(p->bufs, 0, p->nbufs * p->bufsize);
+    cha_wipe(&p->ctx);
+    free(p->bufs);
+    free(p);
+}
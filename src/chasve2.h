@@ -0,0 +1,91 @@
+#include <arm_sve.h>
+#include <stdint.h>
+
+// clang-format off
+
+/* Vector length agnostic: one block per 32-bit lane, as many blocks as the
+ * vector has lanes (up to BATCH_BLOCKS). SVE2 XAR does the xor and rotate of
+ * each quarter round step in one instruction. Sizeless SVE types cannot form
+ * arrays, so the state is in sixteen named variables. */
+
+#define SVE_QUARTERROUND(a, b, c, d)                                           \
+    a = svadd_u32_x(pg, a, b); d = svxar_n_u32(d, a, 16);                      \
+    c = svadd_u32_x(pg, c, d); b = svxar_n_u32(b, c, 20);                      \
+    a = svadd_u32_x(pg, a, b); d = svxar_n_u32(d, a, 24);                      \
+    c = svadd_u32_x(pg, c, d); b = svxar_n_u32(b, c, 25)
+
+/* Add original word i and write it to each block, XOR with input if any */
+#define SVE_STORE(v, i, o)                                                     \
+    {                                                                          \
+        svuint32_t w = svadd_u32_x(pg, v, o);                                  \
+        if (in) w = sveor_u32_x(pg, w, svld1_gather_u32index_u32(pg, (const uint32_t*)in + i, index)); \
+        svst1_scatter_u32index_u32(pg, (uint32_t*)buf + i, index, w);          \
+    }
+
+CHA_INLINE uint64_t _cha_sve2_impl(
+  uint8_t* buf, const uint8_t* in, size_t bufsize, uint32_t state[16], unsigned rounds
+) {
+    // Batches must fit BATCH_SIZE evenly: a power of two, at most 16 blocks
+    uint64_t n = svcntw();
+    if (n > BATCH_BLOCKS) n = BATCH_BLOCKS;
+    while (n & (n - 1)) n &= n - 1;
+    const svbool_t pg = svwhilelt_b32_u64(0, n);
+    const svuint32_t lane = svindex_u32(0, 1);
+    const svuint32_t index = svindex_u32(0, 16); // First word of each block
+    const uint64_t batchsize = n * CHA_BLOCK_SIZE, batches = bufsize / batchsize;
+    uint64_t counter = state[12] | (uint64_t)state[13] << 32;
+    for (uint64_t b = batches; b-->0;) {
+        const svuint32_t c12 = svadd_n_u32_x(pg, lane, (uint32_t)counter);
+        const svuint32_t c13 = svadd_n_u32_m(
+          svcmplt_u32(pg, c12, lane), svdup_n_u32(counter >> 32), 1
+        );
+        svuint32_t x0 = svdup_n_u32(state[0]), x1 = svdup_n_u32(state[1]),
+                   x2 = svdup_n_u32(state[2]), x3 = svdup_n_u32(state[3]),
+                   x4 = svdup_n_u32(state[4]), x5 = svdup_n_u32(state[5]),
+                   x6 = svdup_n_u32(state[6]), x7 = svdup_n_u32(state[7]),
+                   x8 = svdup_n_u32(state[8]), x9 = svdup_n_u32(state[9]),
+                   x10 = svdup_n_u32(state[10]), x11 = svdup_n_u32(state[11]),
+                   x12 = c12, x13 = c13,
+                   x14 = svdup_n_u32(state[14]), x15 = svdup_n_u32(state[15]);
+        CHA_UNROLL
+        for (unsigned r = rounds / 2; r-->0;) {
+            // Mix columns
+            SVE_QUARTERROUND(x0, x4, x8, x12);
+            SVE_QUARTERROUND(x1, x5, x9, x13);
+            SVE_QUARTERROUND(x2, x6, x10, x14);
+            SVE_QUARTERROUND(x3, x7, x11, x15);
+            // Mix diagonals
+            SVE_QUARTERROUND(x0, x5, x10, x15);
+            SVE_QUARTERROUND(x1, x6, x11, x12);
+            SVE_QUARTERROUND(x2, x7, x8, x13);
+            SVE_QUARTERROUND(x3, x4, x9, x14);
+        }
+        SVE_STORE(x0, 0, svdup_n_u32(state[0]));
+        SVE_STORE(x1, 1, svdup_n_u32(state[1]));
+        SVE_STORE(x2, 2, svdup_n_u32(state[2]));
+        SVE_STORE(x3, 3, svdup_n_u32(state[3]));
+        SVE_STORE(x4, 4, svdup_n_u32(state[4]));
+        SVE_STORE(x5, 5, svdup_n_u32(state[5]));
+        SVE_STORE(x6, 6, svdup_n_u32(state[6]));
+        SVE_STORE(x7, 7, svdup_n_u32(state[7]));
+        SVE_STORE(x8, 8, svdup_n_u32(state[8]));
+        SVE_STORE(x9, 9, svdup_n_u32(state[9]));
+        SVE_STORE(x10, 10, svdup_n_u32(state[10]));
+        SVE_STORE(x11, 11, svdup_n_u32(state[11]));
+        SVE_STORE(x12, 12, c12);
+        SVE_STORE(x13, 13, c13);
+        SVE_STORE(x14, 14, svdup_n_u32(state[14]));
+        SVE_STORE(x15, 15, svdup_n_u32(state[15]));
+        counter += n;
+        buf += batchsize;
+        if (in) in += batchsize;
+    }
+    state[12] = (uint32_t)counter;
+    state[13] = (uint32_t)(counter >> 32);
+    return batches * batchsize;
+}
+
+CHA_INSTANCES(_cha_sve2)
+
+#undef SVE_QUARTERROUND
+#undef SVE_STORE
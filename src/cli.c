@@ -1,17 +1,37 @@
+#define _GNU_SOURCE
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <inttypes.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#endif
 
 #include "charandom.h"
 
+#ifndef CPU_SETSIZE
+#define CPU_SETSIZE 1024
+#endif
+
 static volatile bool quit = false;
 
 void signal_handler(int sig) {
@@ -22,40 +42,298 @@ void signal_handler(int sig) {
 
 #define BLOCK_SIZE (1 << 21) // 2 MiB seems optimal for speed
 
+#define RING_SLOTS 4 // Buffers each worker may run ahead of the writer
+#define DIRECT_ALIGN 4096 // O_DIRECT offset and length granularity
+#define MAX_DEFAULT_WORKERS 32 // Each worker holds RING_SLOTS buffers
+#define RATE_PIECE 0.0005 // Seconds of output per write with --rate
+#define RATE_BURST 10000000 // Nanoseconds of lag that --rate catches up
+#define RATE_SPIN 50000 // Nanoseconds before a deadline spent spinning
+#define STATS_INTERVAL 1000000000 // Nanoseconds between stats lines
+#define STATS_BUCKETS 24 // Write latencies by powers of two microseconds
+
+static int stats_fd = -1; // Instrumentation as JSON lines, or -1 for none
+
+/// Progress and summary on stderr, unless it carries the JSON lines of --stats
+static inline bool messages(void) { return stats_fd != 2; }
+
 static const unsigned char default_iv[16] = "\0\0\0\0\0\0\0\0RandQuik";
+
+/// Single producer single consumer ring of buffers, one per worker
+typedef struct ring {
+    _Atomic uint32_t head; // Buffers produced, only advanced by the worker
+    _Atomic uint32_t tail; // Buffers released, only advanced by the writer
+    unsigned char* slot[RING_SLOTS];
+} ring;
+
 typedef struct thread_args {
     int index;
-    int done;
-    unsigned char* buf;
+    int cpu; // Pinned to this CPU, or -1
+    ring ring;
+    uint64_t skip;
     unsigned char key[32];
     unsigned workers;
     unsigned rounds;
-    pthread_mutex_t lock;
-    pthread_cond_t cond;
     pthread_t thread;
+    // Only kept with stats_fd. Relaxed, they are read by the writer.
+    _Atomic uint64_t gen_ns;  // Generating buffers
+    _Atomic uint64_t wait_ns; // Waiting for a free slot
 } thread_args;
 
+static uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static void stats_add(_Atomic uint64_t* counter, uint64_t ns) {
+    atomic_store_explicit(
+      counter, atomic_load_explicit(counter, memory_order_relaxed) + ns,
+      memory_order_relaxed
+    );
+}
+
+/// Worker buffers are aligned to their size so that they may be backed by
+/// transparent huge pages, which also suits O_DIRECT and vmsplice.
+unsigned char* buffer_alloc(void) {
+    void* buf;
+    if (posix_memalign(&buf, BLOCK_SIZE, BLOCK_SIZE)) {
+        fprintf(stderr, "\r\e[KOut of memory\n");
+        exit(1);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(buf, BLOCK_SIZE, MADV_HUGEPAGE);
+#endif
+    return buf;
+}
+
+/// Block while *addr == val, spinning briefly before sleeping in the kernel
+static void ring_wait(_Atomic uint32_t* addr, uint32_t val) {
+    for (unsigned spin = 0;
+         atomic_load_explicit(addr, memory_order_acquire) == val && !quit;
+         ++spin) {
+        if (spin < 100) {
+            sched_yield();
+            continue;
+        }
+#ifdef __linux__
+        syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+        nanosleep(&(struct timespec){0, 50000}, NULL);
+#endif
+    }
+}
+
+static void ring_advance(_Atomic uint32_t* addr) {
+    atomic_fetch_add_explicit(addr, 1, memory_order_release);
+#ifdef __linux__
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+}
+
+#ifdef __linux__
+/// Parse a sysfs CPU list such as "0-3,8-11"
+static bool read_cpulist(char const* path, cpu_set_t* set) {
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return false;
+    CPU_ZERO(set);
+    for (int a, b, n; (n = fscanf(f, "%d-%d", &a, &b)) >= 1;) {
+        for (int cpu = a; cpu <= (n == 2 ? b : a); ++cpu) CPU_SET(cpu, set);
+        if (fgetc(f) != ',')
+            break;
+    }
+    fclose(f);
+    return true;
+}
+#endif
+
+/// CPUs for pinning workers: all those the process may use, or with numa only
+/// those on the node of the calling thread, which is then restricted to that
+/// node too (threads created later inherit this). Returns the count found.
+unsigned cpu_list(int* cpus, unsigned max, bool numa) {
+    unsigned n = 0;
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof allowed, &allowed) != 0)
+        return 0;
+    if (numa) {
+        const int cpu = sched_getcpu();
+        cpu_set_t node;
+        char path[64];
+        bool found = false;
+        for (int i = 0; i < 1024 && !found; ++i) {
+            snprintf(path, sizeof path, "/sys/devices/system/node/node%d/cpulist", i);
+            found = read_cpulist(path, &node) && cpu >= 0 && CPU_ISSET(cpu, &node);
+        }
+        if (found) {
+            CPU_AND(&allowed, &allowed, &node);
+            sched_setaffinity(0, sizeof allowed, &allowed);
+        }
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < max; ++cpu)
+        if (CPU_ISSET(cpu, &allowed))
+            cpus[n++] = cpu;
+#endif
+    return n;
+}
+
+/// Pin the calling thread to a CPU (-1 for no change)
+static void pin_thread(int cpu) {
+#ifdef __linux__
+    if (cpu < 0)
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+#endif
+}
+
 void* producer_thread(void* a) {
     thread_args* args = (thread_args*)a;
-    const uint64_t ivstep = args->workers * BATCH_BLOCKS;
+    ring* r = &args->ring;
+    // Allocated after pinning, so that first touch puts them on the local node.
+    // The writer reads the slots only after head has advanced.
+    pin_thread(args->cpu);
+    for (int j = 0; j < RING_SLOTS; ++j) r->slot[j] = buffer_alloc();
+    // Skip over the buffers produced by the other workers
+    const uint64_t ivstep = (args->workers - 1) * (BLOCK_SIZE / 64);
     cha_ctx ctx;
     cha_init(&ctx, args->key, default_iv, args->rounds);
-    cha_seek_blocks(&ctx, args->index * BLOCK_SIZE / 64);
-    while (!quit) {
-        pthread_mutex_lock(&args->lock);
-        while (args->done) {
-            pthread_cond_wait(&args->cond, &args->lock);
-        }
-        cha_update(&ctx, args->buf, BLOCK_SIZE);
+    cha_seek(&ctx, args->skip + (uint64_t)args->index * BLOCK_SIZE);
+    const bool stats = stats_fd >= 0;
+    for (uint32_t head = 0; !quit; ++head) {
+        // Wait for a free slot if the ring is full
+        const uint64_t t0 = stats ? now_ns() : 0;
+        ring_wait(&r->tail, head - RING_SLOTS);
+        if (quit)
+            break;
+        const uint64_t t1 = stats ? now_ns() : 0;
+        cha_update(&ctx, r->slot[head % RING_SLOTS], BLOCK_SIZE);
         cha_seek_blocks(&ctx, ivstep);
-        args->done = 1;
-        pthread_cond_signal(&args->cond);
-        pthread_mutex_unlock(&args->lock);
+        if (stats) {
+            stats_add(&args->wait_ns, t1 - t0);
+            stats_add(&args->gen_ns, now_ns() - t1);
+        }
+        ring_advance(&r->head);
     }
+    ring_advance(&r->head); // Wake up the writer, it will see quit
     cha_wipe(&ctx);
     return NULL;
 }
 
+/// Start the producers of a stream beginning at skip, each filling its ring
+void workers_start(
+  thread_args* args, unsigned workers, uint64_t skip,
+  unsigned char const key[32], unsigned rounds, int const* cpus, unsigned ncpus
+) {
+    memset(args, 0, workers * sizeof *args);
+    for (int i = 0; i < workers; ++i) {
+        args[i].index = i;
+        args[i].cpu = ncpus ? cpus[i % ncpus] : -1;
+        args[i].skip = skip;
+        args[i].workers = workers;
+        args[i].rounds = rounds;
+        memcpy(args[i].key, key, 32);
+        pthread_create(&args[i].thread, NULL, producer_thread, &args[i]);
+    }
+}
+
+void workers_stop(thread_args* args, unsigned workers) {
+    quit = true;
+    for (int i = 0; i < workers; ++i) {
+        // Wake up a worker that may be sleeping on a full ring
+        ring_advance(&args[i].ring.tail);
+        pthread_join(args[i].thread, NULL);
+        for (int j = 0; j < RING_SLOTS; ++j) free(args[i].ring.slot[j]);
+    }
+}
+
+/// Write all of buf at offset. With O_DIRECT on fd, the part not a multiple
+/// of DIRECT_ALIGN goes through tailfd that has the same file open normally.
+bool pwrite_full(
+  int fd, int tailfd, unsigned char const* buf, size_t sz, uint64_t offset
+) {
+    size_t aligned = fd == tailfd ? sz : sz & ~(size_t)(DIRECT_ALIGN - 1);
+    for (size_t done = 0; done < sz;) {
+        ssize_t n = done < aligned
+                      ? pwrite(fd, buf + done, aligned - done, offset + done)
+                      : pwrite(tailfd, buf + done, sz - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+typedef enum output_mode {
+    OUTPUT_WRITE,
+    OUTPUT_SPLICE,
+    OUTPUT_DIRECT
+} output_mode;
+typedef struct output {
+    int fd, tailfd;
+    output_mode mode;
+    unsigned lag; // Buffers still possibly referenced by the pipe after a write
+    uint64_t pos; // File position for OUTPUT_DIRECT
+} output;
+
+/// Plain write, or with splice set worker buffers gifted to pipes by vmsplice.
+/// A tailfd other than fd means that fd was opened with O_DIRECT.
+void output_init(
+  output* out, int fd, int tailfd, unsigned buffers, bool splice
+) {
+    out->fd = fd;
+    out->tailfd = tailfd;
+    out->mode = fd == tailfd ? OUTPUT_WRITE : OUTPUT_DIRECT;
+    out->lag = 0;
+    out->pos = 0;
+#ifdef __linux__
+    struct stat st;
+    if (splice && out->mode == OUTPUT_WRITE && fstat(fd, &st) == 0 &&
+        S_ISFIFO(st.st_mode)) {
+        // Pipe pages refer to our buffers until read, so a buffer may only
+        // be refilled once enough other data has been pushed after it. A
+        // reader that splices onward instead of reading keeps referring to
+        // them, which is why this is not the default.
+        fcntl(fd, F_SETPIPE_SZ, BLOCK_SIZE);
+        int pipesize = fcntl(fd, F_GETPIPE_SZ);
+        unsigned lag = (pipesize + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (pipesize > 0 && lag < buffers) {
+            out->mode = OUTPUT_SPLICE;
+            out->lag = lag;
+        }
+    }
+#endif
+}
+
+bool output_write(output* out, unsigned char const* buf, size_t sz) {
+    if (out->mode == OUTPUT_DIRECT) {
+        out->pos += sz;
+        return pwrite_full(out->fd, out->tailfd, buf, sz, out->pos - sz);
+    }
+    while (sz) {
+        ssize_t n;
+#ifdef __linux__
+        if (out->mode == OUTPUT_SPLICE) {
+            struct iovec iov = {(void*)buf, sz};
+            n = vmsplice(out->fd, &iov, 1, SPLICE_F_GIFT);
+        } else
+#endif
+            n = write(out->fd, buf, sz);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += n;
+        sz -= n;
+    }
+    return true;
+}
+
 void print_status(
   uint64_t bytes, uint64_t max_bytes, struct timespec start_time
 ) {
@@ -81,66 +359,691 @@ void print_status(
     );
 }
 
+/// Tell where to continue a fill that did not reach its end
+void print_resume(uint64_t offset) {
+    if (!offset)
+        return;
+    if (messages())
+        fprintf(stderr, "Resume with --skip %" PRIu64 "\n", offset);
+    else
+        fprintf(stderr, "{\"resume\": %" PRIu64 "}\n", offset);
+}
+
+/// Writer side instrumentation of fast()
+typedef struct writer_stats {
+    uint64_t start, next; // Times of start and of the next report
+    uint64_t bytes;       // Written by the last report
+    uint64_t wait_ns;     // Waiting for workers to produce
+    uint64_t write_ns;
+    uint64_t hist[STATS_BUCKETS]; // Writes taking under 2^i microseconds
+} writer_stats;
+
+static void stats_write(writer_stats* ws, uint64_t t0, uint64_t t1) {
+    const uint64_t us = (t1 - t0) / 1000;
+    unsigned b = us ? 64 - __builtin_clzll(us) : 0;
+    ws->hist[b < STATS_BUCKETS ? b : STATS_BUCKETS - 1]++;
+    ws->write_ns += t1 - t0;
+}
+
+/// One JSON line of cumulative times in seconds, the rate since the last
+/// line and the buffers ready in each ring, written at once to stats_fd
+static void stats_report(
+  writer_stats* ws, thread_args* args, unsigned workers, uint64_t bytes,
+  uint64_t now
+) {
+    char* line;
+    size_t len;
+    FILE* f = open_memstream(&line, &len);
+    if (!f)
+        return;
+    const double dt = (now - ws->next + STATS_INTERVAL) * 1e-9;
+    fprintf(
+      f,
+      "{\"time\": %.3f, \"bytes\": %" PRIu64 ", \"gbps\": %.3f, "
+      "\"writer\": {\"wait\": %.6f, \"write\": %.6f, \"write_us_log2\": [",
+      (now - ws->start) * 1e-9, bytes,
+      dt > 0 ? (bytes - ws->bytes) / dt * 1e-9 : 0.0, ws->wait_ns * 1e-9,
+      ws->write_ns * 1e-9
+    );
+    for (unsigned b = 0; b < STATS_BUCKETS; ++b)
+        fprintf(f, "%s%" PRIu64, b ? ", " : "", ws->hist[b]);
+    fprintf(f, "]}, \"workers\": [");
+    for (unsigned i = 0; i < workers; ++i) {
+        ring* r = &args[i].ring;
+        const uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+        const uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        fprintf(
+          f,
+          "%s{\"generate\": %.6f, \"wait\": %.6f, \"buffers\": %" PRIu32
+          ", \"ready\": %" PRIu32 "}",
+          i ? ", " : "",
+          atomic_load_explicit(&args[i].gen_ns, memory_order_relaxed) * 1e-9,
+          atomic_load_explicit(&args[i].wait_ns, memory_order_relaxed) * 1e-9,
+          head, head - tail
+        );
+    }
+    fprintf(f, "]}\n");
+    fclose(f);
+    for (size_t done = 0; done < len;) {
+        ssize_t n = write(stats_fd, line + done, len - done);
+        if (n <= 0 && errno != EINTR)
+            break;
+        if (n > 0)
+            done += n;
+    }
+    free(line);
+    ws->bytes = bytes;
+    ws->next = now + STATS_INTERVAL;
+}
+
+/// Token bucket for --rate: bytes are due at rate since start, up to
+/// RATE_BURST worth of tokens may build up while the output is slow
+typedef struct pacer {
+    double rate;     // Bytes per second, 0 for unlimited
+    size_t piece;    // Bytes written at a time
+    uint64_t start;  // Reference time in ns, 0 until the first piece
+    uint64_t bytes;  // Written since start
+} pacer;
+
+void pacer_init(pacer* p, double rate) {
+    p->rate = rate;
+    // Short enough pieces that a sleep before each keeps jitter low
+    p->piece = (size_t)(rate * RATE_PIECE) & ~(size_t)(DIRECT_ALIGN - 1);
+    if (p->piece < DIRECT_ALIGN)
+        p->piece = DIRECT_ALIGN;
+    if (!rate || p->piece > BLOCK_SIZE)
+        p->piece = BLOCK_SIZE;
+    p->start = 0;
+    p->bytes = 0;
+}
+
+/// Wait until the next sz bytes are due, returns the nanoseconds waited
+static uint64_t pacer_wait(pacer* p, size_t sz) {
+    if (!p->rate)
+        return 0;
+    const uint64_t now = now_ns();
+    // The clock starts with the first piece, not before it was generated
+    if (!p->start)
+        p->start = now;
+    uint64_t due = p->start + (uint64_t)(p->bytes * 1e9 / p->rate);
+    if (now > due + RATE_BURST) {
+        // The bucket is full, the time lost beyond it is not caught up
+        p->start = now - RATE_BURST;
+        p->bytes = 0;
+    }
+    p->bytes += sz;
+    if (now >= due)
+        return 0;
+    // Sleeps overshoot by timer slack and scheduling, so sleep only to
+    // shortly before the deadline and spin on the clock for the rest
+    if (due - now > RATE_SPIN) {
+        const uint64_t wake = due - RATE_SPIN;
+#ifdef __linux__
+        struct timespec t = {wake / 1000000000, wake % 1000000000};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) ==
+                 EINTR &&
+               !quit) {}
+#else
+        const uint64_t ns = wake - now;
+        nanosleep(&(struct timespec){ns / 1000000000, ns % 1000000000}, NULL);
+#endif
+    }
+    while (now_ns() < due && !quit)
+        sched_yield(); // Not to hold up a reader on the same CPU
+    return due - now;
+}
+
+/// Write max_bytes (0 = unlimited) of the stream starting at skip, paced
+/// to rate bytes per second unless 0
 int fast(
-  FILE* f, unsigned workers, uint64_t max_bytes, unsigned char const key[32],
-  unsigned char const iv[16], unsigned rounds
+  output* out, unsigned workers, uint64_t skip, uint64_t max_bytes,
+  unsigned char const key[32], unsigned char const iv[16], unsigned rounds,
+  double rate, int const* cpus, unsigned ncpus
 ) {
     thread_args args[workers];
-    memset(args, 0, sizeof args);
-    for (int i = 0; i < workers; ++i) {
-        args[i].index = i;
-        args[i].buf = malloc(BLOCK_SIZE);
-        args[i].workers = workers;
-        args[i].rounds = rounds;
-        memcpy(args[i].key, key, 32);
-        pthread_mutex_init(&args[i].lock, NULL);
-        pthread_cond_init(&args[i].cond, NULL);
-        pthread_create(&args[i].thread, NULL, producer_thread, &args[i]);
-    }
+    workers_start(args, workers, skip, key, rounds, cpus, ncpus);
+    pacer pace;
+    pacer_init(&pace, rate);
 
     struct timespec start_time;
     clock_gettime(CLOCK_MONOTONIC, &start_time);
+    const bool stats = stats_fd >= 0;
+    writer_stats ws = {};
+    ws.start = now_ns();
+    ws.next = ws.start + STATS_INTERVAL;
+    const bool status = messages();
 
-    int i = -1;
     uint64_t bytes = 0;
-    while (!quit) {
-        i = (i + 1) % workers;
-        pthread_mutex_lock(&args[i].lock);
-        while (!args[i].done) {
-            pthread_cond_wait(&args[i].cond, &args[i].lock);
-        }
-        if (bytes % (1 << 30) == 0 || bytes + BLOCK_SIZE >= max_bytes) {
+    for (uint64_t seq = 0; !quit; ++seq) {
+        // Buffers are taken from the workers in turn to keep the stream order
+        ring* r = &args[seq % workers].ring;
+        const uint32_t n = seq / workers;
+        const uint64_t t0 = stats ? now_ns() : 0;
+        ring_wait(&r->head, n);
+        if (quit)
+            break;
+        const uint64_t t1 = stats ? now_ns() : 0;
+        ws.wait_ns += t1 - t0;
+        if (status &&
+            (bytes % (1 << 30) == 0 || bytes + BLOCK_SIZE >= max_bytes)) {
             print_status(bytes, max_bytes, start_time);
         }
         uint64_t sz = BLOCK_SIZE;
-        if (max_bytes && bytes + sz >= max_bytes) {
-            fprintf(stderr, "\r\e[KMax reached\n");
+        const bool last = max_bytes && bytes + sz >= max_bytes;
+        if (last) {
+            if (status)
+                fprintf(stderr, "\r\e[KMax reached\n");
             sz = max_bytes - bytes;
             quit = true;
         }
-        if (fwrite(args[i].buf, sz, 1, f) != 1) {
-            quit = true;
-            fprintf(stderr, "\r\e[KWrite failed: %s\n", strerror(errno));
+        // In pieces when paced, stopping early on a signal
+        uint64_t slept = 0;
+        for (size_t done = 0, piece; done < sz && (last || !quit); done += piece) {
+            piece = sz - done < pace.piece ? sz - done : pace.piece;
+            slept += pacer_wait(&pace, piece);
+            if (!output_write(out, r->slot[n % RING_SLOTS] + done, piece)) {
+                quit = true;
+                fprintf(stderr, "\r\e[KWrite failed: %s\n", strerror(errno));
+                sz = done + piece;
+                break;
+            }
+            if (quit && !last)
+                sz = done + piece;
         }
         bytes += sz;
-        args[i].done = 0;
-        pthread_cond_signal(&args[i].cond);
-        pthread_mutex_unlock(&args[i].lock);
+        if (stats) {
+            const uint64_t t2 = now_ns();
+            stats_write(&ws, t1 + slept, t2);
+            if (t2 >= ws.next)
+                stats_report(&ws, args, workers, bytes, t2);
+        }
+        if (seq >= out->lag)
+            ring_advance(&args[(seq - out->lag) % workers].ring.tail);
+    }
+
+    if (stats)
+        stats_report(&ws, args, workers, bytes, now_ns());
+    if (status)
+        print_status(bytes, max_bytes, start_time);
+    workers_stop(args, workers);
+    if (status)
+        fprintf(stderr, "\nRandQuik wrote %" PRIu64 " bytes!\n\n", bytes);
+    if (!max_bytes || bytes < max_bytes)
+        print_resume(skip + bytes);
+    return 0;
+}
+
+/// Shared by the parallel fill workers, extents are BLOCK_SIZE aligned
+typedef struct fill_job {
+    int fd, tailfd;
+    char const* pattern; // Shard file names by printf of the index, or NULL
+    uint64_t shard_size; // Stream bytes in each shard file
+    uint64_t start, end;
+    unsigned char key[32];
+    unsigned rounds;
+    _Atomic uint64_t next;    // Next extent to claim
+    _Atomic uint64_t written; // Bytes completed
+} fill_job;
+
+typedef struct fill_args {
+    fill_job* job;
+    int cpu; // Pinned to this CPU, or -1
+    uint64_t unfinished; // Start of an extent left incomplete, or UINT64_MAX
+    int shardfd;    // Open shard file, or -1
+    uint64_t shard; // Its index
+    pthread_t thread;
+} fill_args;
+
+/// Open a shard file of the job, created or cut to its full size
+static int shard_open(fill_job const* job, uint64_t shard) {
+    char name[4096];
+    snprintf(name, sizeof name, job->pattern, (unsigned)shard);
+    int fd = open(name, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0 || ftruncate(fd, job->shard_size) != 0) {
+        fprintf(stderr, "\r\e[KFailed to open %s: %s\n", name, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+#ifdef __linux__
+    fallocate(fd, 0, 0, job->shard_size);
+#endif
+    return fd;
+}
+
+/// Write an extent generated at stream offset, across shard files if any
+static bool fill_write(
+  fill_args* args, unsigned char const* buf, size_t sz, uint64_t offset
+) {
+    fill_job* job = args->job;
+    if (!job->pattern) { // Stream position equals the file offset
+        if (pwrite_full(job->fd, job->tailfd, buf, sz, offset))
+            return true;
+        fprintf(stderr, "\r\e[KWrite failed: %s\n", strerror(errno));
+        return false;
+    }
+    for (size_t done = 0; done < sz;) {
+        const uint64_t shard = (offset + done) / job->shard_size;
+        const uint64_t pos = (offset + done) % job->shard_size;
+        size_t n = sz - done;
+        if (n > job->shard_size - pos)
+            n = job->shard_size - pos;
+        if (args->shardfd < 0 || args->shard != shard) {
+            // Each worker keeps its latest shard open, extents are in order
+            if (args->shardfd >= 0)
+                close(args->shardfd);
+            args->shard = shard;
+            args->shardfd = shard_open(job, shard);
+            if (args->shardfd < 0)
+                return false;
+        }
+        if (!pwrite_full(args->shardfd, args->shardfd, buf + done, n, pos)) {
+            fprintf(stderr, "\r\e[KWrite failed: %s\n", strerror(errno));
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+void* fill_thread(void* a) {
+    fill_args* args = (fill_args*)a;
+    fill_job* job = args->job;
+    pin_thread(args->cpu);
+    unsigned char* buf = buffer_alloc();
+    cha_ctx ctx;
+    cha_init(&ctx, job->key, default_iv, job->rounds);
+    args->unfinished = UINT64_MAX;
+    while (!quit) {
+        uint64_t offset = BLOCK_SIZE * atomic_fetch_add(&job->next, 1);
+        if (offset >= job->end)
+            break;
+        if (offset < job->start)
+            offset = job->start;
+        uint64_t sz = BLOCK_SIZE - offset % BLOCK_SIZE;
+        if (sz > job->end - offset)
+            sz = job->end - offset;
+        args->unfinished = offset;
+        cha_seek(&ctx, offset - cha_tell(&ctx));
+        cha_update(&ctx, buf, sz);
+        if (!fill_write(args, buf, sz, offset)) {
+            quit = true;
+            break;
+        }
+        args->unfinished = UINT64_MAX;
+        atomic_fetch_add(&job->written, sz);
+    }
+    if (args->shardfd >= 0)
+        close(args->shardfd);
+    cha_wipe(&ctx);
+    free(buf);
+    return NULL;
+}
+
+/// Run the workers on a job and report as they go. Returns 0 once complete.
+static int fill(
+  fill_job* job, unsigned workers, int const* cpus, unsigned ncpus
+) {
+    const uint64_t total = job->end - job->start;
+    fill_args args[workers];
+    for (int i = 0; i < workers; ++i) {
+        args[i].job = job;
+        args[i].cpu = ncpus ? cpus[i % ncpus] : -1;
+        args[i].shardfd = -1;
+        pthread_create(&args[i].thread, NULL, fill_thread, &args[i]);
     }
 
-    print_status(bytes, max_bytes, start_time);
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    while (!quit && atomic_load(&job->written) < total) {
+        print_status(atomic_load(&job->written), total, start_time);
+        nanosleep(&(struct timespec){0, 100000000}, NULL);
+    }
+    // Everything before the first extent not written is complete
+    uint64_t resume = BLOCK_SIZE * atomic_load(&job->next);
     for (int i = 0; i < workers; ++i) {
-        args[i].done = 0;
-        pthread_cancel(args[i].thread);
         pthread_join(args[i].thread, NULL);
-        pthread_mutex_destroy(&args[i].lock);
-        pthread_cond_destroy(&args[i].cond);
-        free(args[i].buf);
+        if (args[i].unfinished < resume)
+            resume = args[i].unfinished;
     }
+    const uint64_t bytes = atomic_load(&job->written);
+    if (bytes == total)
+        fprintf(stderr, "\r\e[KMax reached\n");
+    print_status(bytes, total, start_time);
     fprintf(stderr, "\nRandQuik wrote %" PRIu64 " bytes!\n\n", bytes);
+    if (bytes == total)
+        return 0;
+    print_resume(resume);
+    return 1;
+}
+
+/// Fill a file or device with all workers writing their own extents
+int parallel(
+  int fd, int tailfd, unsigned workers, uint64_t skip, uint64_t max_bytes,
+  unsigned char const key[32], unsigned rounds, int const* cpus, unsigned ncpus
+) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !(S_ISREG(st.st_mode) || S_ISBLK(st.st_mode))) {
+        fprintf(stderr, "--parallel needs a regular file or a block device\n");
+        return 1;
+    }
+    if (!max_bytes && S_ISBLK(st.st_mode)) {
+        off_t devsize = lseek(fd, 0, SEEK_END);
+        max_bytes = devsize > 0 ? devsize : 0;
+    }
+#ifdef __linux__
+    // Preallocate to avoid fragmenting the file from many write positions
+    if (max_bytes && S_ISREG(st.st_mode))
+        fallocate(fd, 0, 0, max_bytes);
+#endif
+    if (max_bytes <= skip) {
+        fprintf(stderr, "--parallel needs the size given by -b beyond --skip\n");
+        return 1;
+    }
+    fill_job job = {
+      .fd = fd,
+      .tailfd = tailfd,
+      .start = skip,
+      .end = max_bytes,
+      .rounds = rounds,
+      .next = skip / BLOCK_SIZE,
+    };
+    memcpy(job.key, key, 32);
+    return fill(&job, workers, cpus, ncpus);
+}
+
+/// Write shard files first..last of shard_size bytes, named by printf of the
+/// pattern. Together in order they are the stream, and each is the part of
+/// the stream at its index times shard_size, so that any may be redone alone.
+int sharded(
+  char const* pattern, uint64_t first, uint64_t last, uint64_t shard_size,
+  unsigned workers, uint64_t skip, unsigned char const key[32],
+  unsigned rounds, int const* cpus, unsigned ncpus
+) {
+    fill_job job = {
+      .pattern = pattern,
+      .shard_size = shard_size,
+      .start = first * shard_size > skip ? first * shard_size : skip,
+      .end = (last + 1) * shard_size,
+      .rounds = rounds,
+    };
+    if (job.start >= job.end) {
+        fprintf(stderr, "Nothing to write, --skip is beyond the last shard\n");
+        return 1;
+    }
+    job.next = job.start / BLOCK_SIZE;
+    memcpy(job.key, key, 32);
+    return fill(&job, workers, cpus, ncpus);
+}
+
+/// Shard file names need exactly one conversion such as %u or %05u
+static bool shard_pattern(char const* pattern) {
+    unsigned conversions = 0;
+    for (char const* p = pattern; (p = strchr(p, '%')); ++p) {
+        if (p[1] == '%') {
+            ++p;
+            continue;
+        }
+        p += 1 + strspn(p + 1, "0123456789");
+        if (*p != 'u' && *p != 'd')
+            return false;
+        ++conversions;
+    }
+    return conversions == 1;
+}
+
+#ifdef __linux__
+#define SERVE_MAX_CLIENTS 256 // Each connected client holds one buffer
+
+typedef struct client {
+    int fd;
+    unsigned index;     // In the clients of serve
+    unsigned char* buf; // Its own BLOCK_SIZE of the stream, or NULL
+    size_t pos;         // Sent of buf
+    uint64_t sent;
+} client;
+
+/// Swap spare for the next buffer of the stream, releasing its slot at once
+static unsigned char* serve_take(
+  thread_args* args, unsigned workers, uint64_t* seq, unsigned char* spare
+) {
+    ring* r = &args[*seq % workers].ring;
+    const uint32_t n = *seq / workers;
+    ring_wait(&r->head, n);
+    if (quit)
+        return NULL;
+    // The worker reads the slot pointer only after tail has advanced
+    unsigned char* buf = r->slot[n % RING_SLOTS];
+    r->slot[n % RING_SLOTS] = spare;
+    ring_advance(&r->tail);
+    ++*seq;
+    return buf;
+}
+
+/// The socket path of a unix:path, /path or ./path address, else NULL
+static char const* serve_unix_path(char const* addr) {
+    if (strncmp(addr, "unix:", 5) == 0)
+        return addr + 5;
+    return addr[0] == '/' || addr[0] == '.' ? addr : NULL;
+}
+
+/// Listen on a UNIX socket path or on [host]:port
+static int serve_listen(char const* addr) {
+    int fd;
+    char const* path = serve_unix_path(addr);
+    if (path) {
+        struct sockaddr_un sa = {.sun_family = AF_UNIX};
+        if (!*path || strlen(path) >= sizeof sa.sun_path) {
+            fprintf(stderr, "Invalid socket path: %s\n", addr);
+            return -1;
+        }
+        strcpy(sa.sun_path, path);
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(path); // Left over by an earlier server
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && bind(fd, (struct sockaddr*)&sa, sizeof sa) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    } else if (!strchr(addr, ':')) {
+        // A bare port or name is more likely a typo than a socket file
+        fprintf(
+          stderr, "Expected unix:path, /path, ./path or [host]:port to serve "
+                  "on, not %s\n", addr
+        );
+        return -1;
+    } else {
+        char host[256];
+        char const* port = strrchr(addr, ':') + 1;
+        int hostlen = port - 1 - addr;
+        if (hostlen >= 2 && addr[0] == '[' && addr[hostlen - 1] == ']')
+            ++addr, hostlen -= 2; // [::1]:port
+        snprintf(host, sizeof host, "%.*s", hostlen, addr);
+        struct addrinfo hints = {
+          .ai_flags = AI_PASSIVE,
+          .ai_family = AF_UNSPEC,
+          .ai_socktype = SOCK_STREAM,
+        }, *res;
+        int err = getaddrinfo(*host ? host : NULL, port, &hints, &res);
+        if (err) {
+            fprintf(stderr, "Unable to serve on %s: %s\n", addr, gai_strerror(err));
+            return -1;
+        }
+        fd = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        const int one = 1;
+        if (fd >= 0)
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+        if (fd >= 0 && bind(fd, res->ai_addr, res->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+    }
+    if (fd < 0 || listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "Unable to serve on %s: %s\n", addr, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void serve_close(int epfd, client** clients, unsigned* n, client* c) {
+    clients[c->index] = clients[--*n];
+    clients[c->index]->index = c->index;
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    // Unsent bytes are dropped, no part of the stream goes to two clients
+    free(c->buf);
+    free(c);
+}
+
+/// Send until the socket is full, false when the client is done or gone
+static bool serve_send(
+  client* c, thread_args* args, unsigned workers, uint64_t* seq,
+  uint64_t max_bytes, uint64_t* bytes
+) {
+    while (!quit) {
+        if (max_bytes && c->sent >= max_bytes)
+            return false;
+        if (!c->buf || c->pos == BLOCK_SIZE) {
+            unsigned char* spare = c->buf ? c->buf : buffer_alloc();
+            c->buf = serve_take(args, workers, seq, spare);
+            c->pos = 0;
+            if (!c->buf) {
+                free(spare);
+                return false;
+            }
+        }
+        size_t sz = BLOCK_SIZE - c->pos;
+        if (max_bytes && sz > max_bytes - c->sent)
+            sz = max_bytes - c->sent;
+        ssize_t n = send(c->fd, c->buf + c->pos, sz, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        c->pos += n;
+        c->sent += n;
+        *bytes += n;
+    }
+    return false;
+}
+
+/// Keep the workers running and hand each client its own stream buffers.
+/// Every buffer goes to one client only, so clients get disjoint counter
+/// ranges of the same stream, each at most max_bytes (0 = unlimited).
+int serve(
+  char const* addr, unsigned workers, uint64_t skip, uint64_t max_bytes,
+  unsigned char const key[32], unsigned rounds, int const* cpus, unsigned ncpus
+) {
+    const int lfd = serve_listen(addr);
+    if (lfd < 0)
+        return 1;
+    const int epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+    thread_args args[workers];
+    workers_start(args, workers, skip, key, rounds, cpus, ncpus);
+    fprintf(stderr, "Serving on %s\n", addr);
+
+    uint64_t seq = 0, bytes = 0, served = 0;
+    client* clients[SERVE_MAX_CLIENTS];
+    unsigned nclients = 0;
+    struct epoll_event events[64];
+    while (!quit) {
+        // A timeout to notice quit, as signals may land on another thread
+        const int nev = epoll_wait(epfd, events, 64, 100);
+        for (int i = 0; i < nev && !quit; ++i) {
+            client* c = events[i].data.ptr;
+            if (c) {
+                if (events[i].events & (EPOLLERR | EPOLLHUP) ||
+                    !serve_send(c, args, workers, &seq, max_bytes, &bytes))
+                    serve_close(epfd, clients, &nclients, c);
+                continue;
+            }
+            for (int fd; (fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0;) {
+                if (nclients == SERVE_MAX_CLIENTS || !(c = calloc(1, sizeof *c))) {
+                    close(fd);
+                    continue;
+                }
+                c->fd = fd;
+                c->index = nclients;
+                clients[nclients++] = c;
+                ev = (struct epoll_event){.events = EPOLLOUT, .data.ptr = c};
+                epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+                ++served;
+            }
+        }
+    }
+    while (nclients)
+        serve_close(epfd, clients, &nclients, clients[0]);
+    workers_stop(args, workers);
+    close(lfd);
+    close(epfd);
+    if (serve_unix_path(addr))
+        unlink(serve_unix_path(addr));
+    fprintf(
+      stderr, "\r\e[KRandQuik served %" PRIu64 " bytes to %" PRIu64 " clients!\n",
+      bytes, served
+    );
+    print_resume(skip + seq * BLOCK_SIZE);
+    return 0;
+}
+#endif
+
+/// Multiplier of a unit such as k, MB, GiB, or 0 if not known
+static uint64_t unit_multiplier(char const* unit) {
+    static const struct {
+        char const* unit;
+        uint64_t mult;
+    } units[] = {
+      {"", 1},
+      {"b", 1},
+      {"k", 1000ull},
+      {"kb", 1000ull},
+      {"m", 1000000ull},
+      {"mb", 1000000ull},
+      {"g", 1000000000ull},
+      {"gb", 1000000000ull},
+      {"t", 1000000000000ull},
+      {"tb", 1000000000000ull},
+      {"ki", 1ull << 10},
+      {"kib", 1ull << 10},
+      {"mi", 1ull << 20},
+      {"mib", 1ull << 20},
+      {"gi", 1ull << 30},
+      {"gib", 1ull << 30},
+      {"ti", 1ull << 40},
+      {"tib", 1ull << 40},
+    };
+    for (size_t i = 0; i < sizeof units / sizeof *units; ++i)
+        if (strcasecmp(unit, units[i].unit) == 0)
+            return units[i].mult;
     return 0;
 }
 
+/// Parse a byte count with an optional unit such as k, MB, GiB
+bool parse_bytes(char const* str, uint64_t* bytes) {
+    char unit[16] = {};
+    if (sscanf(str, "%" SCNu64 "%15s", bytes, unit) < 1)
+        return false;
+    const uint64_t mult = unit_multiplier(unit);
+    *bytes *= mult;
+    return mult != 0;
+}
+
+/// Parse bytes per second such as 3.2GB/s, the /s being optional
+bool parse_rate(char const* str, double* rate) {
+    char unit[16] = {};
+    if (sscanf(str, "%lf%15s", rate, unit) < 1 || !(*rate > 0))
+        return false;
+    const size_t len = strlen(unit);
+    if (len >= 2 && strcmp(unit + len - 2, "/s") == 0)
+        unit[len - 2] = '\0';
+    *rate *= unit_multiplier(unit);
+    return *rate > 0;
+}
+
 bool parse_hex(char* str, unsigned char* buf, size_t len) {
     for (size_t i = 0; i < len; ++i) {
         int sz = 0;
@@ -166,20 +1069,78 @@ void help(char** argv) {
     fprintf(
       stderr,
       "Usage: %s [-t #threads] [-s hexseed] [-b #bytes] [-r #rounds] [-o "
-      "outputfile]\n\n",
-      argv[0]
+      "outputfile [--parallel] [--direct]] [--vmsplice] [-k|--skip #bytes] [--pin|--numa] "
+      "[--serve address] [--shards #shards|first-last] [--stats|--stats-fd #fd] [--rate bytes/s]"
+      "\n\n"
+      "  -t          Worker threads, by default one per CPU (up to %d)\n"
+      "  --parallel  All threads write their own parts of the output file\n"
+      "  --direct    Bypass the page cache (O_DIRECT) when writing the file\n"
+      "  --vmsplice  Hand buffers to an output pipe without copying. Only for\n"
+      "              readers that read the pipe: tee, pv --splice and others\n"
+      "              that splice it onward would get overwritten data.\n"
+      "  --skip      Start at this stream position, also in the output file.\n"
+      "              The -b size still counts from the beginning of stream.\n"
+      "  --pin       Pin each worker thread to its own CPU\n"
+      "  --numa      Pin workers to the CPUs of the writer's NUMA node only\n"
+      "  --serve     Serve distinct parts of the stream (-b bytes each) to all\n"
+      "              clients of a UNIX socket unix:path, /path or ./path, or\n"
+      "              of a TCP [host]:port\n"
+      "  --shards    Write the stream as files of -b bytes each, named by the\n"
+      "              -o pattern such as shard%%05u.bin, all or only first-last\n"
+      "  --stats     Worker and writer timings of the sequential output as\n"
+      "              JSON lines each second, on stderr or the given descriptor\n"
+      "  --rate      Write at this steady rate such as 3.2GB/s\n\n",
+      argv[0], MAX_DEFAULT_WORKERS
     );
 }
 
 int main(int argc, char** argv) {
     unsigned char key[32] = {};
     unsigned char iv[16] = {};
-    unsigned int workers = 8;
+    unsigned int workers = 0; // Default from CPUs
     unsigned int rounds = 20;
-    char* output = NULL;
-    uint64_t max_bytes = 0;
-    bool seeded = false;
-    for (char opt; (opt = getopt(argc, argv, "bostr")) != -1;) {
+    char* filename = NULL;
+    char const* serve_addr = NULL;
+    uint64_t shard_first = 0, shard_last = 0;
+    bool shards = false;
+    uint64_t max_bytes = 0, skip = 0;
+    double rate = 0;
+    bool seeded = false, parallel_fill = false, direct = false;
+    bool vmsplice_out = false;
+    bool pin = false, numa = false;
+    static const struct option long_options[] = {
+      {"parallel", no_argument, NULL, 'P'},
+      {"direct", no_argument, NULL, 'D'},
+      {"vmsplice", no_argument, NULL, 'V'},
+      {"skip", no_argument, NULL, 'k'},
+      {"pin", no_argument, NULL, 'A'},
+      {"numa", no_argument, NULL, 'N'},
+      {"serve", no_argument, NULL, 'S'},
+      {"shards", no_argument, NULL, 'H'},
+      {"stats", no_argument, NULL, 'M'},
+      {"stats-fd", no_argument, NULL, 'F'},
+      {"rate", no_argument, NULL, 'R'},
+      {},
+    };
+    for (int opt;
+         (opt = getopt_long(argc, argv, "bostrk", long_options, NULL)) != -1;) {
+        if (opt == 'P') {
+            parallel_fill = true;
+            continue;
+        }
+        if (opt == 'D') {
+            direct = true;
+            continue;
+        }
+        if (opt == 'V') {
+            vmsplice_out = true;
+            continue;
+        }
+        if (opt == 'A' || opt == 'N') {
+            pin = true;
+            numa |= opt == 'N';
+            continue;
+        }
         if (opt == 't') {
             if (optind >= argc || sscanf(argv[optind++], "%u", &workers) != 1) {
                 fprintf(
@@ -213,48 +1174,149 @@ int main(int argc, char** argv) {
                 return 1;
             }
             if (strcmp(argv[optind], "-") != 0) {
-                output = argv[optind++];
+                filename = argv[optind++];
             }
             continue;
         }
         if (opt == 'b') {
-            char unit[16] = {};
-            if (optind >= argc || sscanf(argv[optind++], "%" SCNu64 "%15s", &max_bytes, unit) < 1) {
+            if (optind >= argc || !parse_bytes(argv[optind++], &max_bytes)) {
                 fprintf(
                   stderr,
                   "Expected a maximum number of bytes to read after -b\n"
                 );
                 return 1;
             }
-            if (strcasecmp(unit, "k") == 0 || strcasecmp(unit, "kb") == 0)
-                max_bytes *= 1000ull;
-            else if (strcasecmp(unit, "m") == 0 || strcasecmp(unit, "mb") == 0)
-                max_bytes *= 1000000ull;
-            else if (strcasecmp(unit, "g") == 0 || strcasecmp(unit, "gb") == 0)
-                max_bytes *= 1000000000ull;
-            else if (strcasecmp(unit, "t") == 0 || strcasecmp(unit, "tb") == 0)
-                max_bytes *= 1000000000000ull;
-            else if (strcasecmp(unit, "ki") == 0 || strcasecmp(unit, "kib") == 0)
-                max_bytes <<= 10;
-            else if (strcasecmp(unit, "mi") == 0 || strcasecmp(unit, "mib") == 0)
-                max_bytes <<= 20;
-            else if (strcasecmp(unit, "gi") == 0 || strcasecmp(unit, "gib") == 0)
-                max_bytes <<= 30;
-            else if (strcasecmp(unit, "ti") == 0 || strcasecmp(unit, "tib") == 0)
-                max_bytes <<= 40;
             continue;
         }
+        if (opt == 'S') {
+            if (optind >= argc) {
+                fprintf(
+                  stderr, "Expected a socket path or host:port after --serve\n"
+                );
+                return 1;
+            }
+            serve_addr = argv[optind++];
+            continue;
+        }
+        if (opt == 'R') {
+            if (optind >= argc || !parse_rate(argv[optind++], &rate)) {
+                fprintf(stderr, "Expected bytes per second after --rate\n");
+                return 1;
+            }
+            continue;
+        }
+        if (opt == 'M') {
+            stats_fd = 2;
+            continue;
+        }
+        if (opt == 'F') {
+            if (optind >= argc || sscanf(argv[optind++], "%d", &stats_fd) != 1 ||
+                fcntl(stats_fd, F_GETFD) < 0) {
+                fprintf(
+                  stderr, "Expected an open file descriptor after --stats-fd\n"
+                );
+                return 1;
+            }
+            continue;
+        }
+        if (opt == 'H') {
+            int n = 0;
+            if (optind >= argc ||
+                (n = sscanf(
+                   argv[optind++], "%" SCNu64 "-%" SCNu64, &shard_first,
+                   &shard_last
+                 )) < 1 ||
+                (n == 1 && !shard_first) || (n == 2 && shard_last < shard_first)) {
+                fprintf(
+                  stderr, "Expected a number of shards or first-last after --shards\n"
+                );
+                return 1;
+            }
+            if (n == 1) {
+                shard_last = shard_first - 1;
+                shard_first = 0;
+            }
+            shards = true;
+            continue;
+        }
+        if (opt == 'k') {
+            if (optind >= argc || !parse_bytes(argv[optind++], &skip)) {
+                fprintf(
+                  stderr, "Expected a starting byte position after --skip\n"
+                );
+                return 1;
+            }
+            continue;
+        }
+        help(argv);
+        return 1;
+    }
+    if (serve_addr && (filename || parallel_fill || direct)) {
+        fprintf(stderr, "--serve does not write an output file\n\n");
+        help(argv);
+        return 1;
+    }
+    if (rate && (parallel_fill || shards || serve_addr)) {
+        fprintf(stderr, "--rate only paces the sequential output\n\n");
+        help(argv);
+        return 1;
+    }
+    if (stats_fd >= 0 && (parallel_fill || shards || serve_addr)) {
+        fprintf(stderr, "--stats only instruments the sequential output\n\n");
+        help(argv);
+        return 1;
+    }
+    if (shards) {
+        if (!filename || !shard_pattern(filename) || !max_bytes ||
+            parallel_fill || direct || serve_addr) {
+            fprintf(
+              stderr, "--shards needs -b and an -o pattern with one %%u, and "
+                      "no --parallel, --direct or --serve\n\n"
+            );
+            help(argv);
+            return 1;
+        }
+    } else if (max_bytes && skip >= max_bytes && !serve_addr) {
+        fprintf(stderr, "Nothing to write, --skip is beyond -b\n");
+        return 1;
+    }
+    if (direct) {
+        // Rewriting the same bytes before an unaligned skip keeps O_DIRECT happy
+        skip &= ~(uint64_t)(DIRECT_ALIGN - 1);
+    }
+    int fd = 1, tailfd = 1;
+    if ((parallel_fill || direct) && !filename) {
+        fprintf(
+          stderr, "%s needs an output file given by -o\n\n",
+          parallel_fill ? "--parallel" : "--direct"
+        );
         help(argv);
         return 1;
     }
-    FILE* f = stdout;
-    if (output) {
-        f = fopen(output, "wb");
-        if (!f) {
-            fprintf(stderr, "Failed to open %s for writing.\n", output);
+    if (filename && !shards) {
+        // A resumed fill keeps what was written before the skip position
+        fd = tailfd =
+          open(filename, O_WRONLY | O_CREAT | (skip ? 0 : O_TRUNC), 0666);
+        if (fd < 0) {
+            fprintf(stderr, "Failed to open %s for writing.\n", filename);
             return 1;
         }
-    } else if (isatty(1)) {
+        if (direct) {
+#ifdef O_DIRECT
+            // Unaligned tail writes keep using the normally opened tailfd
+            fd = open(filename, O_WRONLY | O_DIRECT);
+            if (fd < 0) {
+                fprintf(
+                  stderr, "Failed to open %s for direct I/O: %s\n", filename,
+                  strerror(errno)
+                );
+                return 1;
+            }
+#elif defined(F_NOCACHE)
+            fcntl(fd, F_NOCACHE, 1);
+#endif
+        }
+    } else if (!filename && isatty(1) && !serve_addr) {
         fprintf(
           stderr,
           "Won't print random on console. Pipe me to another program or "
@@ -274,22 +1336,74 @@ int main(int argc, char** argv) {
             return 1;
         }
         fclose(urand);
-        fprintf(
-          stderr,
-          "Random seed generated. This sequence may be repeated by:\n%s ",
-          argv[0]
-        );
-        if (rounds != 20)
-            fprintf(stderr, "-r %u -s ", rounds);
-        else
-            fprintf(stderr, "-s ");
+        if (!messages()) {
+            // Still repeatable, as a JSON line among the stats
+            fprintf(stderr, "{\"seed\": \"");
+            print_hex(key, 32);
+            fprintf(stderr, "\", \"rounds\": %u}\n", rounds);
+        } else {
+            fprintf(
+              stderr,
+              "Random seed generated. This sequence may be repeated by:\n%s ",
+              argv[0]
+            );
+            if (rounds != 20)
+                fprintf(stderr, "-r %u -s ", rounds);
+            else
+                fprintf(stderr, "-s ");
 
-        print_hex(key, 32);
-        fprintf(stderr, "\n\n");
+            print_hex(key, 32);
+            fprintf(stderr, "\n\n");
+        }
+    }
+    int cpus[CPU_SETSIZE];
+    unsigned ncpus = 0;
+    if (pin) {
+        ncpus = cpu_list(cpus, CPU_SETSIZE, numa);
+        if (!ncpus)
+            fprintf(stderr, "CPU pinning is not available, continuing without\n");
+    }
+    if (!workers) {
+        long online = ncpus ? ncpus : sysconf(_SC_NPROCESSORS_ONLN);
+        workers = online < 1                     ? 1
+                  : online > MAX_DEFAULT_WORKERS ? MAX_DEFAULT_WORKERS
+                                                 : online;
     }
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
-    int ret = fast(f, workers, max_bytes, key, iv, rounds);
-    fclose(f);
+    int ret;
+    if (serve_addr) {
+#ifdef __linux__
+        ret = serve(
+          serve_addr, workers, skip, max_bytes, key, rounds, cpus, ncpus
+        );
+#else
+        fprintf(stderr, "--serve is only available on Linux\n");
+        ret = 1;
+#endif
+    } else if (shards) {
+        ret = sharded(
+          filename, shard_first, shard_last, max_bytes, workers, skip, key,
+          rounds, cpus, ncpus
+        );
+    } else if (parallel_fill) {
+        ret = parallel(
+          fd, tailfd, workers, skip, max_bytes, key, rounds, cpus, ncpus
+        );
+    } else {
+        output out;
+        output_init(&out, fd, tailfd, workers * RING_SLOTS, vmsplice_out);
+        if (skip && filename) {
+            out.pos = skip;
+            lseek(fd, skip, SEEK_SET);
+        }
+        ret = fast(
+          &out, workers, skip, max_bytes ? max_bytes - skip : 0, key, iv, rounds,
+          rate, cpus, ncpus
+        );
+    }
+    close(fd);
+    if (tailfd != fd)
+        close(tailfd);
     return ret;
 }
@@ -1,6 +1,8 @@
 #cython: language_level=3
 
 from libc.stdint cimport int64_t, uint32_t, uint8_t, uint64_t
+from cpython.bytes cimport PyBytes_AS_STRING, PyBytes_FromStringAndSize
+from cpython.mem cimport PyMem_Free, PyMem_Malloc
 from cpython.pycapsule cimport PyCapsule_IsValid, PyCapsule_GetPointer
 import numpy as np
 cimport numpy as np
@@ -12,40 +14,200 @@ from numpy.random cimport BitGenerator
 np.import_array()
 
 cdef extern from "chanumpy.h":
+    enum: BATCH_SIZE
+
     struct cha_ctx:
         uint32_t state[16]
-        uint8_t unconsumed[512]
+        uint8_t unconsumed[BATCH_SIZE]
         uint32_t offset, end;
         unsigned rounds;
 
-    void cha_init(cha_ctx* ctx, const uint8_t* key, const uint8_t* iv, unsigned rounds) nogil
-    void cha_seek(cha_ctx* ctx, int64_t offset)
-    int64_t cha_tell(cha_ctx* ctx)
+    struct cha_np:
+        cha_ctx ctx
+        uint8_t* buf
+        uint32_t bufsize, offset, end
+
+    void cha_np_init(cha_np* st, const uint8_t* key, const uint8_t* iv, unsigned rounds, uint8_t* buf, uint32_t bufsize) nogil
+    void cha_np_wipe(cha_np* st) nogil
+    void cha_np_seek(cha_np* st, int64_t offset)
+    int64_t cha_np_tell(cha_np* st)
+    uint64_t cha_np_nonce(const cha_np* st)
+    void cha_np_stream(cha_np* st, const cha_np* src, uint64_t nonce)
 
     uint64_t cha_uint64(void *state) nogil
     uint32_t cha_uint32(void *state) nogil
     double cha_double(void *state) nogil
 
+    void cha_fill_bytes(cha_np* st, void* out, size_t len) nogil
+    void cha_fill_double(cha_np* st, double* out, size_t n) nogil
+    void cha_fill_float(cha_np* st, float* out, size_t n) nogil
+    void cha_fill_bounded(cha_np* st, uint32_t* out, size_t n, uint32_t bound) nogil
+    void cha_fill_normal(cha_np* st, double* out, size_t n) nogil
+
 
 cdef class Cha(BitGenerator):
-    cdef cha_ctx rng_state
+    """ChaCha bit generator. Draws are served from a buffer of buffer_size
+    bytes (rounded up to whole kernel batches) that is refilled at once."""
+    cdef cha_np rng_state
 
-    def __init__(self, seed=None, *, rounds=20):
+    def __init__(self, seed=None, *, rounds=20, buffer_size=4096):
+        self._setup(seed, buffer_size)
+        # Generated state is ChaCha20 key
+        key = self._seed_seq.generate_state(4, np.uint64)
+        cha_np_init(&self.rng_state, <uint8_t *>np.PyArray_DATA(key), bytes(16) + b"NumpRand", rounds, self.rng_state.buf, self.rng_state.bufsize)
+
+    cdef _setup(self, seed, buffer_size):
+        if buffer_size < 1:
+            raise ValueError("buffer_size must be positive")
+        buffer_size = -(-buffer_size // BATCH_SIZE) * BATCH_SIZE
         BitGenerator.__init__(self, seed)
         self._bitgen.state = <void *>&self.rng_state
         self._bitgen.next_uint64 = &cha_uint64
         self._bitgen.next_uint32 = &cha_uint32
         self._bitgen.next_double = &cha_double
         self._bitgen.next_raw = &cha_uint64
-        # Generated state is ChaCha20 key
-        key = self._seed_seq.generate_state(4, np.uint64)
-        cha_init(&self.rng_state, <uint8_t *>np.PyArray_DATA(key), bytes(16) + b"NumpRand", rounds)
+        cdef uint8_t* buf = <uint8_t*>PyMem_Malloc(buffer_size)
+        if buf is NULL:
+            raise MemoryError()
+        cha_np_wipe(&self.rng_state)
+        PyMem_Free(self.rng_state.buf)
+        self.rng_state.buf = buf
+        self.rng_state.bufsize = buffer_size
+
+    def __dealloc__(self):
+        cha_np_wipe(&self.rng_state)
+        PyMem_Free(self.rng_state.buf)
+
+    cdef Cha _derive(self, seed, uint64_t nonce):
+        cdef Cha child = Cha.__new__(Cha)
+        child._setup(seed, self.rng_state.bufsize)
+        cha_np_stream(&child.rng_state, &self.rng_state, nonce)
+        return child
+
+    # Independent streams share the key and differ in the 64-bit nonce, each
+    # nonce being 2^70 bytes of its own that cannot overlap with another.
+
+    def jumped(self, jumps=1):
+        """New generator on the stream `jumps` nonces ahead of this one, from
+        its start. Consecutive jumps give disjoint streams for workers."""
+        return self._derive(self._seed_seq, cha_np_nonce(&self.rng_state) + jumps)
+
+    def spawn(self, n_children):
+        """Child generators of the same key, following SeedSequence.spawn so
+        that every child in the spawn tree has its own nonce."""
+        children = []
+        for seq in self._seed_seq.spawn(n_children):
+            nonce = int(seq.generate_state(1, np.uint64)[0])
+            children.append(self._derive(seq, nonce))
+        return children
+
+    def __reduce__(self):
+        # Key, nonce and position: enough to rebuild a worker's generator
+        key = PyBytes_FromStringAndSize(<char*>&self.rng_state.ctx.state[4], 32)
+        return _restore, (
+            self._seed_seq, key, cha_np_nonce(&self.rng_state),
+            cha_np_tell(&self.rng_state), self.rng_state.ctx.rounds,
+            self.rng_state.bufsize,
+        )
 
     def advance(self, delta):
-        cha_seek(&self.rng_state, delta << 3)
+        cha_np_seek(&self.rng_state, delta << 3)
 
     def tell(self):
-        return cha_tell(&self.rng_state) >> 3;
+        return cha_np_tell(&self.rng_state) >> 3;
 
     def state(self):
-        return self.rng_state.state[12], self.rng_state.state[13]
+        return self.rng_state.ctx.state[12], self.rng_state.ctx.state[13]
+
+    @property
+    def buffer_size(self):
+        return self.rng_state.bufsize
+
+    # Bulk fills straight from the SIMD kernel, bypassing per-draw callbacks
+
+    def random_raw(self, size=None, output=True):
+        """Raw 64-bit words, same as the per-draw next_raw"""
+        if size is None:
+            with self.lock:
+                word = cha_uint64(&self.rng_state)
+            return word if output else None
+        cdef np.ndarray out = np.empty(size, np.uint64)
+        self._fill(out)
+        return out if output else None
+
+    def bytes(self, length):
+        """Random bytes, consuming length / 8 words rounded up"""
+        cdef object out = PyBytes_FromStringAndSize(NULL, length)
+        cdef char* buf = PyBytes_AS_STRING(out)
+        cdef size_t n = length
+        with self.lock, nogil:
+            cha_fill_bytes(&self.rng_state, buf, n)
+        return out
+
+    def fill(self, np.ndarray out):
+        """Fill a contiguous array of any dtype with raw random bits"""
+        if not out.flags.c_contiguous or not out.flags.writeable:
+            raise ValueError("Output must be a writable C contiguous array")
+        self._fill(out)
+        return out
+
+    def random(self, size=None, dtype=np.float64, out=None):
+        """Floats in [0, 1). float64 matches Generator.random on this bit
+        generator, float32 uses both halves of each 64-bit word instead."""
+        dtype = np.dtype(dtype)
+        if dtype != np.float64 and dtype != np.float32:
+            raise TypeError("Unsupported dtype for random")
+        if out is None:
+            out = np.empty(() if size is None else size, dtype)
+        elif out.dtype != dtype or not out.flags.c_contiguous or not out.flags.writeable:
+            raise ValueError("out must be a writable C contiguous array of dtype")
+        cdef void* data = np.PyArray_DATA(<np.ndarray>out)
+        cdef size_t n = out.size
+        cdef bint f64 = dtype.itemsize == 8
+        with self.lock, nogil:
+            if f64:
+                cha_fill_double(&self.rng_state, <double*>data, n)
+            else:
+                cha_fill_float(&self.rng_state, <float*>data, n)
+        return out[()] if size is None and out.ndim == 0 else out
+
+    def bounded(self, bound, size=None):
+        """uint32 integers in [0, bound) without modulo bias, each from half
+        a 64-bit word, by vectorised multiply and shift"""
+        if not 0 < bound < 1 << 32:
+            raise ValueError("bound must be in 1 to 2**32 - 1")
+        cdef np.ndarray out = np.empty(() if size is None else size, np.uint32)
+        cdef uint32_t* data = <uint32_t*>np.PyArray_DATA(out)
+        cdef size_t n = out.size
+        cdef uint32_t b = bound
+        with self.lock, nogil:
+            cha_fill_bounded(&self.rng_state, data, n, b)
+        return out[()] if size is None else out
+
+    def standard_normal(self, size=None, out=None):
+        """float64 normals by a vectorised Ziggurat, one word each (plus a
+        few redraws). Faster than, and not the same as, Generator's."""
+        if out is None:
+            out = np.empty(() if size is None else size, np.float64)
+        elif out.dtype != np.float64 or not out.flags.c_contiguous or not out.flags.writeable:
+            raise ValueError("out must be a writable C contiguous float64 array")
+        cdef double* data = <double*>np.PyArray_DATA(<np.ndarray>out)
+        cdef size_t n = out.size
+        with self.lock, nogil:
+            cha_fill_normal(&self.rng_state, data, n)
+        return out[()] if size is None and out.ndim == 0 else out
+
+    cdef _fill(self, np.ndarray out):
+        cdef void* data = np.PyArray_DATA(out)
+        cdef size_t n = out.nbytes
+        with self.lock, nogil:
+            cha_fill_bytes(&self.rng_state, data, n)
+
+
+def _restore(seed_seq, bytes key, nonce, int64_t position, unsigned rounds, buffer_size):
+    cdef Cha gen = Cha.__new__(Cha)
+    gen._setup(seed_seq, buffer_size)
+    iv = bytes(8) + nonce.to_bytes(8, "little")
+    cha_np_init(&gen.rng_state, key, iv, rounds, gen.rng_state.buf, gen.rng_state.bufsize)
+    cha_np_seek(&gen.rng_state, position)
+    return gen
@@ -1,9 +1,18 @@
+import os
+import pickle
+import shutil
+import subprocess
+import time
+from array import array
+from concurrent.futures import ThreadPoolExecutor
 from secrets import randbelow, token_bytes
 
+import numpy as np
 import pytest
 from cryptography.hazmat.primitives.ciphers import Cipher
 from cryptography.hazmat.primitives.ciphers.algorithms import ChaCha20
 
+import nprand
 from randquik import cha
 
 
@@ -73,3 +82,185 @@ def test_cipherstreams_32leftover():
         ct1 = c1(bytearray(N))
         assert len(ct0) == len(ct1)
         assert ct0.hex() == ct1.hex()
+
+
+@pytest.mark.parametrize("threads", [0, 2, 5])
+def test_threads_identical(threads):
+    """Parallel generation must give the same stream as serial"""
+    key = token_bytes(32)
+    iv = token_bytes(16)
+    N = (3 << 20) + 123
+    assert cha.generate(N, key, iv, threads=threads) == cha.generate(N, key, iv)
+
+    c0 = Cipher(ChaCha20(key, iv), None, None).encryptor()
+    c1 = cha.Cha(key, iv, threads=threads)
+    for N in [100, 1 << 20, 5, (2 << 20) + 77, 4096]:
+        ct0 = c0.update(bytes(N))
+        ct1 = c1(bytearray(N))
+        assert ct0.hex() == ct1.hex(), f"{N=}"
+
+
+def test_fill_many():
+    """Batched fill equals filling each buffer in turn"""
+    key = token_bytes(32)
+    iv = token_bytes(16)
+    c0 = Cipher(ChaCha20(key, iv), None, None).encryptor()
+    c1 = cha.Cha(key, iv)
+    sizes = [randbelow(5000) for _ in range(500)]
+    bufs = c1.fill_many([bytearray(N) for N in sizes])
+    for N, buf in zip(sizes, bufs):
+        assert c0.update(bytes(N)).hex() == buf.hex()
+
+
+def test_generate_many():
+    """Streams of their own keys generated together equal each alone"""
+    sizes = [randbelow(600) for _ in range(300)]
+    keys = [token_bytes(32) for _ in sizes]
+    ivs = [token_bytes(16) for _ in sizes]
+    bufs = cha.generate_many([bytearray(N) for N in sizes], keys, ivs)
+    for N, key, iv, buf in zip(sizes, keys, ivs, bufs):
+        c0 = Cipher(ChaCha20(key, iv), None, None).encryptor()
+        assert c0.update(bytes(N)).hex() == buf.hex()
+
+
+def test_xor():
+    """Keystream XOR matches ChaCha20 encryption, also in place"""
+    key = token_bytes(32)
+    iv = token_bytes(16)
+    c0 = Cipher(ChaCha20(key, iv), None, None).encryptor()
+    c1 = cha.Cha(key, iv)
+    c2 = cha.Cha(key, iv)
+    for i in range(256):
+        N = randbelow(5000)
+        data = token_bytes(N)
+        ct0 = c0.update(data)
+        assert c1.xor(data, bytearray(N)).hex() == ct0.hex(), f"{i=} {N=}"
+        assert c2.xor(bytearray(data)).hex() == ct0.hex(), f"{i=} {N=}"
+
+
+def test_distributions():
+    """Uniforms are exact conversions of the stream, others in range"""
+    key = token_bytes(32)
+    iv = token_bytes(16)
+    raw = memoryview(cha.Cha(key, iv)(bytearray(8 * 1000))).cast("Q")
+    rng = cha.Cha(key, iv)
+    uniform = rng.uniform(array("d", bytes(8 * 1000)))
+    assert list(uniform) == [(x >> 11) * 2**-53 for x in raw]
+    ints = rng.bounded(array("I", bytes(4 * 10000)), 7)
+    assert set(ints) == set(range(7))
+    normal = rng.normal(array("d", bytes(8 * 10000)))
+    mean = sum(normal) / len(normal)
+    var = sum((x - mean) ** 2 for x in normal) / len(normal)
+    assert abs(mean) < 0.05 and abs(var - 1) < 0.05
+
+
+def test_random_bytes():
+    """Seeded per thread, never repeating between threads or calls"""
+    with ThreadPoolExecutor(8) as pool:
+        outs = list(pool.map(lambda n: cha.random_bytes(n), [32] * 64))
+    outs += [cha.random_bytes(32) for _ in range(64)]
+    assert all(len(b) == 32 for b in outs)
+    assert len(set(map(bytes, outs))) == len(outs)
+    assert len(cha.random_bytes(100_000)) == 100_000
+
+
+def test_map():
+    """Reads of the lazily generated map equal the stream at their offset"""
+    key = token_bytes(32)
+    iv = token_bytes(16)
+    try:
+        m = cha.Map(1 << 40, key, iv, cached=2)
+    except OSError:
+        pytest.skip("userfaultfd is not available")
+    assert len(m) == 1 << 40
+    for _ in range(50):
+        offset = randbelow((1 << 40) - 1000)
+        assert m.data[offset : offset + 1000].hex() == _at(key, iv, offset, 1000).hex()
+
+
+def _at(key, iv, offset, n):
+    """The stream at any offset, with the block counter in the iv"""
+    counter = int.from_bytes(iv[:8], "little") + offset // 64
+    iv2 = (counter % (1 << 64)).to_bytes(8, "little") + iv[8:]
+    c = Cipher(ChaCha20(key, iv2), None, None).encryptor()
+    return c.update(bytes(offset % 64 + n))[offset % 64 :]
+
+
+@pytest.mark.parametrize("N", [1, 3, 63, 64, 65, 600, 1000])
+def test_nprand_bulk(N):
+    """Bulk fills equal single draws, also from mid-batch across refills"""
+    seed = randbelow(1 << 128)
+    bulk = nprand.Cha(seed)
+    single = np.random.Generator(nprand.Cha(seed))
+    assert bulk.random_raw() == single.bit_generator.random_raw()
+    raw = [single.bit_generator.random_raw() for _ in range(N)]
+    assert bulk.random_raw(N).tolist() == raw
+    assert bulk.random(N).tolist() == [single.random() for _ in range(N)]
+
+
+def test_nprand_raw_output():
+    """random_raw with output=False returns None and still advances"""
+    seed = randbelow(1 << 128)
+    gen = nprand.Cha(seed)
+    ref = nprand.Cha(seed)
+    assert gen.random_raw(output=False) is None
+    assert gen.random_raw(5, output=False) is None
+    ref.random_raw(6)
+    assert gen.random_raw() == ref.random_raw()
+
+
+@pytest.mark.parametrize("buffer_size", [1, 1000, 1 << 16])
+def test_nprand_buffer_size(buffer_size):
+    """The stream does not depend on the buffer size"""
+    seed = randbelow(1 << 128)
+    ref = nprand.Cha(seed)
+    gen = nprand.Cha(seed, buffer_size=buffer_size)
+    assert gen.buffer_size >= buffer_size
+    assert gen.random_raw(20000).tolist() == ref.random_raw(20000).tolist()
+    assert [gen.random_raw() for _ in range(3000)] == [
+        ref.random_raw() for _ in range(3000)
+    ]
+
+
+def test_nprand_streams():
+    """Spawned and jumped generators are distinct streams, jumps repeatable"""
+    gen = nprand.Cha(randbelow(1 << 128))
+    gens = [gen, *gen.spawn(4), gen.jumped(), gen.jumped(2)]
+    draws = [g.random_raw(64).tobytes() for g in gens]
+    assert len(set(draws)) == len(draws)
+    assert gen.jumped(2).random_raw(64).tobytes() == draws[-1]
+    assert gens[1].jumped().random_raw(64).tobytes() not in draws
+
+
+def test_nprand_pickle():
+    """A pickled generator continues exactly where it was, mid-buffer"""
+    gen = nprand.Cha(randbelow(1 << 128), rounds=12, buffer_size=1000)
+    for g in [gen, gen.jumped(3), gen.spawn(1)[0]]:
+        g.random_raw(13)
+        g.random_raw()  # Leaves most of the buffer unconsumed
+        clone = pickle.loads(pickle.dumps(g))
+        assert clone.buffer_size == g.buffer_size
+        assert clone.random_raw() == g.random_raw()
+        assert clone.random_raw(1000).tolist() == g.random_raw(1000).tolist()
+
+
+def test_cli_rate():
+    """--rate keeps the output within a millisecond of its schedule"""
+    exe = os.environ.get("RANDQUIK_CLI") or shutil.which("randquik")
+    if not exe:
+        pytest.skip("randquik CLI not found, set RANDQUIK_CLI")
+    rate = 50_000_000
+    args = [exe, "-s", "00", "-b", str(rate), "--rate", str(rate)]
+    proc = subprocess.Popen(args, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    fd = proc.stdout.fileno()
+    late, got, start = [], 0, None
+    while chunk := os.read(fd, 1 << 16):
+        now = time.monotonic()
+        if start is None:
+            start = now - len(chunk) / rate
+        got += len(chunk)
+        late.append(now - start - got / rate)
+    assert proc.wait() == 0 and got == rate
+    late.sort(key=abs)
+    assert abs(late[len(late) * 99 // 100]) < 1e-3
+    assert abs(late[-1]) < 0.02